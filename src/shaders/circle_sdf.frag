@@ -0,0 +1,20 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragLocal;
+layout(location = 2) flat in float fragRadius;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+	// Signed distance to the circle edge in pixels, negative inside
+	const float distance = (length(fragLocal) - 1.0) * fragRadius;
+	const float coverage = clamp(0.5 - distance, 0.0, 1.0);
+
+	if (coverage <= 0.0)
+		discard;
+
+	outColor = vec4(fragColor, coverage);
+}
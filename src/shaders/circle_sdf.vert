@@ -0,0 +1,87 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// camera_constants in renderer_helper.h
+layout(push_constant) uniform Camera
+{
+	mat4 viewProj;
+	vec4 screenToClip;	// projection of screen space positions, scale in xy and offset in zw
+	float zoom;
+} camera;
+
+// Packed instances carry a screen space position (quarter pixels) instead of a world space one
+layout(constant_id = 0) const bool PACKED_INSTANCES = false;
+
+// No per-vertex stream, the quad corner comes from the index
+#ifdef PULLED_INSTANCES
+// Same storage buffers as the pulled build of shaders.vert
+layout(std430, set = 0, binding = 0) readonly buffer VisibleIds
+{
+	uint visibleIds[];
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Positions
+{
+	vec2 positions[];
+};
+
+// Tightly packed vec3, read as floats
+layout(std430, set = 0, binding = 2) readonly buffer Colors
+{
+	float colors[];
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer Scales
+{
+	float scales[];
+};
+
+vec2	inInstancePos;
+vec3	inInstanceColor;
+float	inInstanceScale;
+
+void fetchInstance()
+{
+	const uint id = visibleIds[gl_InstanceIndex];
+
+	inInstancePos = positions[id];
+	inInstanceColor = vec3(colors[3 * id + 0], colors[3 * id + 1], colors[3 * id + 2]);
+	inInstanceScale = scales[id];
+}
+#else
+layout(location = 1) in vec2	inInstancePos;
+layout(location = 2) in vec3	inInstanceColor;
+layout(location = 3) in float	inInstanceScale;
+#endif
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragLocal;		// position inside the quad, circle edge at length 1
+layout(location = 2) flat out float fragRadius;	// radius in pixels
+
+void main()
+{
+#ifdef PULLED_INSTANCES
+	fetchInstance();
+#endif
+
+	const vec2 corner = vec2((gl_VertexIndex & 1) != 0 ? 1.0 : -1.0, (gl_VertexIndex & 2) != 0 ? 1.0 : -1.0);
+
+	const float radius = inInstanceScale * camera.zoom;
+
+	// One extra pixel around the circle for the antialiased edge
+	const float extent = 1.0 + 1.0 / max(radius, 0.5);
+
+	fragColor = inInstanceColor;
+	fragLocal = corner * extent;
+	fragRadius = radius;
+
+	if (PACKED_INSTANCES)
+	{
+		const vec2 center = inInstancePos * (32767.0 / 4.0);
+		gl_Position = vec4((corner * extent * radius + center) * camera.screenToClip.xy + camera.screenToClip.zw, 0.0, 1.0);
+	}
+	else
+	{
+		gl_Position = camera.viewProj * vec4(corner * extent * inInstanceScale + inInstancePos, 0.0, 1.0);
+	}
+}
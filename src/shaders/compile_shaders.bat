@@ -1,3 +1,9 @@
-C:/VulkanSDK/1.1.106.0/Bin32/glslangValidator.exe -V shaders.vert
-C:/VulkanSDK/1.1.106.0/Bin32/glslangValidator.exe -V shaders.frag
+C:/VulkanSDK/1.1.106.0/Bin32/glslangValidator.exe -V shaders.vert -o shaders.vert.spv
+C:/VulkanSDK/1.1.106.0/Bin32/glslangValidator.exe -V shaders.frag -o shaders.frag.spv
+C:/VulkanSDK/1.1.106.0/Bin32/glslangValidator.exe -V simulate.comp -o simulate.comp.spv
+C:/VulkanSDK/1.1.106.0/Bin32/glslangValidator.exe -V cull.comp -o cull.comp.spv
+C:/VulkanSDK/1.1.106.0/Bin32/glslangValidator.exe -V circle_sdf.vert -o circle_sdf.vert.spv
+C:/VulkanSDK/1.1.106.0/Bin32/glslangValidator.exe -V circle_sdf.frag -o circle_sdf.frag.spv
+C:/VulkanSDK/1.1.106.0/Bin32/glslangValidator.exe -V shaders.vert -DPULLED_INSTANCES -o shaders.pulled.vert.spv
+C:/VulkanSDK/1.1.106.0/Bin32/glslangValidator.exe -V circle_sdf.vert -DPULLED_INSTANCES -o circle_sdf.pulled.vert.spv
 pause
\ No newline at end of file
@@ -1,21 +1,79 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding = 0) uniform UniformBufferObject
+// camera_constants in renderer_helper.h
+layout(push_constant) uniform Camera
 {
-	mat4 view;
-	mat4 proj;
-} ubo;
+	mat4 viewProj;
+	vec4 screenToClip;	// projection of screen space positions, scale in xy and offset in zw
+	float zoom;
+} camera;
+
+// Packed instances carry a screen space position (quarter pixels) instead of a world space one
+layout(constant_id = 0) const bool PACKED_INSTANCES = false;
 
 layout(location = 0) in vec2	inPos;
+#ifdef PULLED_INSTANCES
+// Built a second time with PULLED_INSTANCES defined: no instance bindings, the cull pass only writes the ids of the
+// visible circles and their data is read from the same storage buffers it was culled from (instance_layout::pulled)
+layout(std430, set = 0, binding = 0) readonly buffer VisibleIds
+{
+	uint visibleIds[];
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Positions
+{
+	vec2 positions[];
+};
+
+// Tightly packed vec3, read as floats
+layout(std430, set = 0, binding = 2) readonly buffer Colors
+{
+	float colors[];
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer Scales
+{
+	float scales[];
+};
+
+// Same names as the attributes of the other build, main() reads them the same way
+vec2	inInstancePos;
+vec3	inInstanceColor;
+float	inInstanceScale;
+
+void fetchInstance()
+{
+	// gl_InstanceIndex includes the firstInstance of the bucket's draw
+	const uint id = visibleIds[gl_InstanceIndex];
+
+	inInstancePos = positions[id];
+	inInstanceColor = vec3(colors[3 * id + 0], colors[3 * id + 1], colors[3 * id + 2]);
+	inInstanceScale = scales[id];
+}
+#else
 layout(location = 1) in vec2	inInstancePos;
 layout(location = 2) in vec3	inInstanceColor;
 layout(location = 3) in float	inInstanceScale;
+#endif
 
 layout(location = 0) out vec3 fragColor;
 
 void main()
 {
-	gl_Position = ubo.proj * ubo.view * vec4(inPos * inInstanceScale + inInstancePos, 0.0, 1.0);
+#ifdef PULLED_INSTANCES
+	fetchInstance();
+#endif
+
+	if (PACKED_INSTANCES)
+	{
+		const vec2 center = inInstancePos * (32767.0 / 4.0);
+		gl_Position = vec4((inPos * inInstanceScale * camera.zoom + center) * camera.screenToClip.xy + camera.screenToClip.zw, 0.0, 1.0);
+	}
+	else
+	{
+		gl_Position = camera.viewProj * vec4(inPos * inInstanceScale + inInstancePos, 0.0, 1.0);
+	}
+
 	fragColor = inInstanceColor;
 }
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
 #include "renderer_helper.h"
 
 #ifdef _WIN32
@@ -9,7 +12,7 @@
 #endif
 
 #ifdef __linux__ 
-		// Get Linux File Path
+#include <unistd.h>
 #elif _WIN32
 #include<Windows.h>
 #endif
@@ -19,7 +22,19 @@ typedef uint32_t size;
 constexpr int screen_width = 1280;
 constexpr int screen_height = 720;
 
-constexpr size		instance_count = 1 << 0;
+constexpr size		default_instance_count = 1 << 0;
+constexpr size		max_instance_count = 10000000;
+
+constexpr uint32_t	default_frames_in_flight = 2;
+constexpr uint32_t	max_frames_in_flight = 3;
+// Color images the headless mode cycles through in place of a swap chain
+constexpr uint32_t	offscreen_image_count = 3;
+// Headless runs without an explicit frame limit
+constexpr uint32_t	default_measured_frames = 1000;
+
+// Fixed circle tessellation, every level of detail has to stay addressable with 16 bit indices
+constexpr uint32_t	min_circle_segments = 3;
+constexpr uint32_t	max_circle_segments = 65536;
 
 #define MAX_TITLE_CHARS 128
 static char title[MAX_TITLE_CHARS];
@@ -30,12 +45,48 @@ namespace files
 {
 	static std::string get_app_path()
 	{
-		char current_path[FILENAME_MAX];
+		char current_path[FILENAME_MAX] = {};
 #ifdef __linux__ 
-		// Get Linux File Path
+		const ssize_t length = readlink("/proc/self/exe", current_path, sizeof(current_path) - 1);
+		if (length > 0)
+			current_path[length] = '\0';
 #elif _WIN32
 		GetModuleFileNameA(0, current_path, sizeof(current_path));
 #endif
 		return std::string(current_path);
 	}
-}
\ No newline at end of file
+
+	// Directory of the executable, with the trailing separator
+	static std::string get_app_directory()
+	{
+		const std::string path = get_app_path();
+		return path.substr(0, path.find_last_of("\\/") + 1);
+	}
+}
+
+namespace arguments
+{
+	// Whole argument as an unsigned 32 bit number. Logs and returns false for anything else ("abc", "-1", "12x",
+	// out of range) instead of letting std::stoul throw.
+	static bool parse_uint(const char* option, const std::string& text, uint32_t& value)
+	{
+		try
+		{
+			size_t end = 0;
+			const unsigned long long parsed = std::stoull(text, &end);
+
+			if (end == text.size() && text.find('-') == std::string::npos && parsed <= std::numeric_limits<uint32_t>::max())
+			{
+				value = static_cast<uint32_t>(parsed);
+				return true;
+			}
+		}
+		catch (const std::logic_error&)
+		{
+			// std::invalid_argument and std::out_of_range
+		}
+
+		log("Invalid value \"" << text << "\" for " << option << ", expected an unsigned 32 bit number");
+		return false;
+	}
+}
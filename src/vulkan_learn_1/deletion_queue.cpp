@@ -0,0 +1,34 @@
+#include "deletion_queue.h"
+
+namespace renderer
+{
+	void deletion_queue::push(const uint64_t& last_frame, std::function<void()>&& destroy)
+	{
+		this->entries.push_back({ last_frame, std::move(destroy) });
+	}
+
+	void deletion_queue::collect(const uint64_t& completed_frame)
+	{
+		// Entries may wait for later frames than ones pushed after them, a handful at most, so all are looked at
+		for (auto it = this->entries.begin(); it != this->entries.end();)
+		{
+			if (it->last_frame <= completed_frame)
+			{
+				it->destroy();
+				it = this->entries.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	void deletion_queue::flush()
+	{
+		for (auto& entry : this->entries)
+			entry.destroy();
+
+		this->entries.clear();
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+namespace renderer
+{
+	// Objects replaced while frames in flight may still use them (swap chain, its views and framebuffers). Each entry
+	// remembers the frame that has to complete before it can go, usually the last one submitted when it was retired,
+	// so replacing them never waits on the device. Frames are numbered by the caller, in submission order on one queue.
+	struct deletion_queue
+	{
+	public:
+		void push(const uint64_t& last_frame, std::function<void()>&& destroy);
+
+		// Destroys everything waiting for completed_frame or an earlier one
+		void collect(const uint64_t& completed_frame);
+		// Destroys everything, the device has to be idle
+		void flush();
+
+		size_t get_pending() const
+		{
+			return entries.size();
+		}
+
+	private:
+		struct entry
+		{
+			uint64_t last_frame;
+			std::function<void()> destroy;
+		};
+
+		// In push order, destroyed in that order among the ones completing together
+		std::deque<entry> entries;
+	};
+}
@@ -0,0 +1,338 @@
+#include "job_system.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace renderer
+{
+	namespace
+	{
+		// Worker threads know their own index, any other thread counts as worker 0
+		thread_local const job_system* current_system = nullptr;
+		thread_local uint32_t current_worker = 0;
+	}
+
+	job_system::~job_system()
+	{
+		release();
+	}
+
+	bool job_system::initialize(uint32_t thread_count)
+	{
+		release();
+
+		if (thread_count == 0)
+			thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+		this->stopping = false;
+
+		for (uint32_t i = 0; i < thread_count; ++i)
+			this->workers.push_back(std::make_unique<worker>());
+
+		// All deques exist before the first thread starts stealing from them
+		for (uint32_t i = 1; i < thread_count; ++i)
+			this->workers[i]->thread = std::thread(&job_system::worker_loop, this, i);
+
+		return true;
+	}
+
+	void job_system::release()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->sleep_mutex);
+			this->stopping = true;
+		}
+		this->wake.notify_all();
+
+		for (auto& w : this->workers)
+		{
+			if (w->thread.joinable())
+				w->thread.join();
+		}
+
+		this->workers.clear();
+		this->queued_count = 0;
+	}
+
+	uint32_t job_system::add_job_type(const char* name)
+	{
+		for (size_t i = 0; i < this->types.size(); ++i)
+		{
+			if (strcmp(this->types[i].name, name) == 0)
+				return static_cast<uint32_t>(i);
+		}
+
+		this->types.emplace_back();
+		this->types.back().name = name;
+		return static_cast<uint32_t>(this->types.size() - 1);
+	}
+
+	uint32_t job_system::get_worker_index() const
+	{
+		return current_system == this ? current_worker : 0;
+	}
+
+	void job_system::worker_loop(const uint32_t& index)
+	{
+		current_system = this;
+		current_worker = index;
+
+		for (;;)
+		{
+			if (try_run_job(index))
+				continue;
+
+			std::unique_lock<std::mutex> lock(this->sleep_mutex);
+			this->wake.wait(lock, [this] { return this->stopping || this->queued_count.load() > 0; });
+
+			if (this->stopping)
+				return;
+		}
+	}
+
+	void job_system::push(const uint32_t& index, queued_job job)
+	{
+		worker& w = *this->workers[index];
+
+		std::lock_guard<std::mutex> lock(w.mutex);
+		w.jobs.push_back(std::move(job));
+		++this->queued_count;
+	}
+
+	void job_system::wake_workers(const uint32_t& count)
+	{
+		// Taking the lock orders the wake-up after a worker that just found nothing went to sleep
+		{
+			std::lock_guard<std::mutex> lock(this->sleep_mutex);
+		}
+
+		if (count == 1)
+			this->wake.notify_one();
+		else
+			this->wake.notify_all();
+	}
+
+	bool job_system::try_run_job(const uint32_t& index, const job_counter* only)
+	{
+		if (this->queued_count.load() == 0)
+			return false;
+
+		if (only != nullptr)
+			return try_run_counter_job(*only);
+
+		queued_job job;
+		bool found = false;
+
+		// Own jobs newest first
+		{
+			worker& own = *this->workers[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.jobs.empty())
+			{
+				job = std::move(own.jobs.back());
+				own.jobs.pop_back();
+				found = true;
+			}
+		}
+
+		// Then the oldest of everyone else, starting next door so the thieves spread out
+		const uint32_t worker_count = static_cast<uint32_t>(this->workers.size());
+		for (uint32_t i = 1; i < worker_count && !found; ++i)
+		{
+			worker& victim = *this->workers[(index + i) % worker_count];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.jobs.empty())
+			{
+				job = std::move(victim.jobs.front());
+				victim.jobs.pop_front();
+				found = true;
+			}
+		}
+
+		if (!found)
+			return false;
+
+		--this->queued_count;
+		execute(job);
+
+		return true;
+	}
+
+	bool job_system::try_run_counter_job(const job_counter& counter)
+	{
+		queued_job job;
+		bool found = false;
+
+		for (uint32_t i = 0; i < this->workers.size() && !found; ++i)
+		{
+			worker& w = *this->workers[i];
+			std::lock_guard<std::mutex> lock(w.mutex);
+
+			for (auto it = w.jobs.begin(); it != w.jobs.end(); ++it)
+			{
+				if (it->counter == &counter)
+				{
+					job = std::move(*it);
+					w.jobs.erase(it);
+					found = true;
+					break;
+				}
+			}
+		}
+
+		if (!found)
+			return false;
+
+		--this->queued_count;
+		execute(job);
+
+		return true;
+	}
+
+	void job_system::execute(queued_job& job)
+	{
+		const auto t_start = clock::now();
+		job.function();
+		add_busy_time(job.type, clock::now() - t_start);
+
+		// Last thing touching the job, the waiter may return and destroy the counter right after
+		job.counter->pending.fetch_sub(1, std::memory_order_release);
+	}
+
+	void job_system::add_busy_time(const uint32_t& type, const clock::duration& duration)
+	{
+		if (type >= this->types.size())
+			return;
+
+		this->types[type].jobs.fetch_add(1, std::memory_order_relaxed);
+		this->types[type].busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), std::memory_order_relaxed);
+	}
+
+	void job_system::run(const uint32_t& type, job_counter& counter, job function)
+	{
+		if (this->workers.size() <= 1)
+		{
+			const auto t_start = clock::now();
+			function();
+			add_busy_time(type, clock::now() - t_start);
+			return;
+		}
+
+		counter.pending.fetch_add(1, std::memory_order_relaxed);
+		push(get_worker_index(), { type, &counter, std::move(function) });
+		wake_workers(1);
+	}
+
+	void job_system::wait(job_counter& counter)
+	{
+		if (this->workers.empty())
+			return;
+
+		const uint32_t index = get_worker_index();
+		// Threads outside the pool (render, simulation) share worker 0's deque. A job of the other one could take
+		// much longer than anything this wait is for, so they only help with their own jobs.
+		const job_counter* only = current_system == this ? nullptr : &counter;
+
+		while (!counter.is_done())
+		{
+			if (!try_run_job(index, only))
+				std::this_thread::yield();
+		}
+	}
+
+	void job_system::parallel_for(const uint32_t& type, const uint32_t& count, const uint32_t& grain, const range_job& function)
+	{
+		if (count == 0)
+			return;
+
+		const auto t_start = clock::now();
+		const uint32_t range_size = std::max(grain, 1u);
+		const uint32_t range_count = (count - 1) / range_size + 1;
+
+		if (range_count == 1 || this->workers.size() <= 1)
+		{
+			function(0, count);
+			add_busy_time(type, clock::now() - t_start);
+		}
+		else
+		{
+			job_counter counter;
+			counter.pending = range_count;
+
+			// Queued on the calling worker, which pops its own jobs from the back: the others steal from the front
+			// while it works its way down from the last range
+			const uint32_t index = get_worker_index();
+			for (uint32_t r = 0; r < range_count; ++r)
+			{
+				const uint32_t begin = r * range_size;
+				const uint32_t end = std::min(begin + range_size, count);
+				push(index, { type, &counter, [&function, begin, end] { function(begin, end); } });
+			}
+
+			wake_workers(range_count);
+			wait(counter);
+		}
+
+		if (type < this->types.size())
+		{
+			this->types[type].calls.fetch_add(1, std::memory_order_relaxed);
+			this->types[type].wall_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t_start).count(), std::memory_order_relaxed);
+		}
+	}
+
+	std::vector<job_system::job_stats> job_system::get_stats() const
+	{
+		std::vector<job_stats> stats;
+
+		for (const auto& type : this->types)
+		{
+			job_stats entry;
+			entry.name = type.name;
+			entry.calls = type.calls.load();
+			entry.jobs = type.jobs.load();
+			entry.wall_ms = type.wall_ns.load() / 1e6;
+			entry.busy_ms = type.busy_ns.load() / 1e6;
+			stats.push_back(entry);
+		}
+
+		return stats;
+	}
+
+	void job_system::print_stats() const
+	{
+		const auto stats = get_stats();
+
+		bool any = false;
+		for (const auto& entry : stats)
+			any |= entry.jobs > 0;
+
+		if (!any)
+			return;
+
+		char line[128];
+		snprintf(line, sizeof(line), "%-27s %9s %9s %9s %9s  %s", "job type", "calls", "wall (ms)", "busy (ms)", "speedup", "threads");
+		std::cout << line << std::endl;
+
+		for (const auto& entry : stats)
+		{
+			if (entry.jobs == 0)
+				continue;
+
+			snprintf(line, sizeof(line), "%-27s %9u %9.3f %9.3f %9.2f  %u",
+				entry.name.c_str(), entry.calls, entry.wall_ms, entry.busy_ms, entry.get_speedup(), get_thread_count());
+			std::cout << line << std::endl;
+		}
+	}
+
+	void job_system::reset_stats()
+	{
+		for (auto& type : this->types)
+		{
+			type.calls = 0;
+			type.jobs = 0;
+			type.wall_ns = 0;
+			type.busy_ns = 0;
+		}
+	}
+}
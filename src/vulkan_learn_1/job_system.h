@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace renderer
+{
+	// Jobs still to finish. run() counts a job in before queueing it, the job counts itself out when done,
+	// so anything waiting on the counter waits for every job started with it.
+	struct job_counter
+	{
+		std::atomic<uint32_t> pending{ 0 };
+
+		bool is_done() const
+		{
+			return pending.load(std::memory_order_acquire) == 0;
+		}
+	};
+
+	// Work stealing thread pool. Every worker owns a deque, pushes and pops its own jobs at the back (newest first,
+	// still warm in its cache) and steals from the front of the others (oldest first, usually the biggest pieces).
+	// The thread that calls initialize() is worker 0: it doesn't get a thread of its own but runs jobs whenever it
+	// waits on a counter, so one thread means everything runs inline on the caller. Other threads outside the pool may
+	// start jobs too (they share worker 0's deque), while waiting they only run jobs of the counter they wait on.
+	// Every job belongs to a job type with timings collected for it: the wall time of its parallel_for calls
+	// against the time all workers spent inside its jobs, the ratio is the speedup actually achieved.
+	struct job_system
+	{
+	public:
+		static constexpr uint32_t invalid_type = UINT32_MAX;
+
+		typedef std::function<void()> job;
+		typedef std::function<void(uint32_t begin, uint32_t end)> range_job;
+
+		struct job_stats
+		{
+			std::string name;
+			uint32_t calls = 0;		// parallel_for calls
+			uint32_t jobs = 0;
+			double wall_ms = 0.0;	// parallel_for calls only
+			double busy_ms = 0.0;	// summed over the workers, more threads than cores count preempted time as busy
+
+			double get_speedup() const
+			{
+				return wall_ms > 0.0 ? busy_ms / wall_ms : 0.0;
+			}
+		};
+
+		~job_system();
+
+		// thread_count includes the calling thread, 0 takes one per hardware thread.
+		// Until then, and with a single thread, every job runs inline.
+		bool initialize(uint32_t thread_count = 0);
+		void release();
+
+		uint32_t get_thread_count() const
+		{
+			return std::max(static_cast<uint32_t>(workers.size()), 1u);
+		}
+
+		// Ids are stable for the lifetime of the job system, adding a name again returns the id it already has.
+		// name must outlive the job system. Not thread safe, add the types before the jobs using them run.
+		uint32_t add_job_type(const char* name);
+
+		void run(const uint32_t& type, job_counter& counter, job function);
+		// Runs queued jobs on the calling thread until the counter drops to zero
+		void wait(job_counter& counter);
+
+		// Splits [0, count) into ranges of grain items and returns once all of them are done.
+		// Runs inline when it fits into one range.
+		void parallel_for(const uint32_t& type, const uint32_t& count, const uint32_t& grain, const range_job& function);
+
+		std::vector<job_stats> get_stats() const;
+		void print_stats() const;
+		void reset_stats();
+
+	private:
+		typedef std::chrono::high_resolution_clock clock;
+
+		struct queued_job
+		{
+			uint32_t type;
+			job_counter* counter;
+			job function;
+		};
+
+		struct worker
+		{
+			std::thread thread;
+			std::mutex mutex;
+			std::deque<queued_job> jobs;
+		};
+
+		struct job_type
+		{
+			const char* name = nullptr;
+			std::atomic<uint32_t> calls{ 0 };
+			std::atomic<uint32_t> jobs{ 0 };
+			std::atomic<uint64_t> wall_ns{ 0 };
+			std::atomic<uint64_t> busy_ns{ 0 };
+		};
+
+		void worker_loop(const uint32_t& index);
+		void push(const uint32_t& index, queued_job job);
+		void wake_workers(const uint32_t& count);
+		// only: run nothing but the jobs of this counter
+		bool try_run_job(const uint32_t& index, const job_counter* only = nullptr);
+		bool try_run_counter_job(const job_counter& counter);
+		void execute(queued_job& job);
+		void add_busy_time(const uint32_t& type, const clock::duration& duration);
+		uint32_t get_worker_index() const;
+
+		std::vector<std::unique_ptr<worker>> workers; // worker 0 has no thread
+		std::deque<job_type> types; // a deque never moves its elements, workers hold on to them
+
+		// Idle workers sleep until something is queued
+		std::atomic<uint32_t> queued_count{ 0 };
+		std::mutex sleep_mutex;
+		std::condition_variable wake;
+		bool stopping = false;
+	};
+}
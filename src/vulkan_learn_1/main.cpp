@@ -1,11 +1,85 @@
 #include "vulkan_app.h"
 
-int main()
+#include <cstring>
+#include <string>
+
+int main(int argc, char** argv)
 {
 	VulkanApp app;
+	std::string trace_file;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		// Consumes the option's argument
+		uint32_t value = 0;
+		const auto parse_value = [&]() { ++i; return arguments::parse_uint(argv[i - 1], argv[i], value); };
+
+		if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+		{
+			if (!parse_value())
+				return EXIT_FAILURE;
+			app.set_instance_count(value);
+		}
+		else if (strcmp(argv[i], "--sdf") == 0)
+			app.set_render_mode(circle_render_mode::sdf);
+		else if (strcmp(argv[i], "--packed-instances") == 0)
+			app.set_instance_layout(renderer::instance_layout::packed);
+		else if (strcmp(argv[i], "--pulled-instances") == 0)
+			app.set_instance_layout(renderer::instance_layout::pulled);
+		else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+		{
+			if (!parse_value())
+				return EXIT_FAILURE;
+			app.set_frames_in_flight(value);
+		}
+		else if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
+		{
+			if (!parse_value())
+				return EXIT_FAILURE;
+			app.set_headless();
+			app.set_frame_limit(0, value);
+		}
+		else if (strcmp(argv[i], "--cpu-physics") == 0)
+			app.set_cpu_physics(true);
+		else if (strcmp(argv[i], "--collisions") == 0)
+			app.set_circle_collisions(true);
+		else if (strcmp(argv[i], "--sim-thread") == 0)
+			app.set_simulation_thread(true);
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			if (!parse_value())
+				return EXIT_FAILURE;
+			app.set_worker_threads(value);
+		}
+		else if (strcmp(argv[i], "--parallel-recording") == 0)
+			app.set_parallel_recording(true);
+		else if (strcmp(argv[i], "--no-timeline-semaphores") == 0)
+			app.set_timeline_semaphores(false);
+		else if (strcmp(argv[i], "--shader-dir") == 0 && i + 1 < argc)
+			app.set_shader_directory(argv[++i]);
+		else if (strcmp(argv[i], "--segments") == 0 && i + 1 < argc)
+		{
+			if (!parse_value())
+				return EXIT_FAILURE;
+			app.set_circle_segments(value);
+		}
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+		{
+#if defined(TRACE_ENABLED)
+			trace_file = argv[++i];
+#else
+			// Nothing would be recorded, better to find out before the run than after it
+			log("--trace needs a build with TRACE_ENABLED (the Debug configuration)");
+			return EXIT_FAILURE;
+#endif
+		}
+	}
 
 	if (!app.run())
 		return EXIT_FAILURE;
 
+	if (!trace_file.empty() && !TRACE_WRITE(trace_file))
+		log("Couldn't write trace to " << trace_file);
+
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,510 @@
+#include "memory_allocator.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace renderer
+{
+	namespace
+	{
+		inline uint32_t bit_scan_forward(uint64_t mask)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward64(&index, mask);
+			return static_cast<uint32_t>(index);
+#else
+			return static_cast<uint32_t>(__builtin_ctzll(mask));
+#endif
+		}
+
+		inline uint32_t bit_scan_reverse(uint64_t mask)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanReverse64(&index, mask);
+			return static_cast<uint32_t>(index);
+#else
+			return 63u - static_cast<uint32_t>(__builtin_clzll(mask));
+#endif
+		}
+
+		inline VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+		{
+			return (value + alignment - 1) / alignment * alignment;
+		}
+	}
+
+	bool memory_allocator::initialize(VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize preferred_block_size)
+	{
+		this->physical_device = physical_device;
+		this->device = device;
+		this->preferred_block_size = preferred_block_size;
+
+		vkGetPhysicalDeviceMemoryProperties(physical_device, &this->memory_properties);
+
+		VkPhysicalDeviceProperties device_properties;
+		vkGetPhysicalDeviceProperties(physical_device, &device_properties);
+		this->max_allocation_count = device_properties.limits.maxMemoryAllocationCount;
+
+		return true;
+	}
+
+	void memory_allocator::release()
+	{
+		for (auto& pool : this->pools)
+		{
+			for (auto& block : pool.blocks)
+			{
+				if (block.device_memory != VK_NULL_HANDLE)
+					vkFreeMemory(this->device, block.device_memory, nullptr);
+			}
+		}
+
+		for (auto& memory : this->dedicated)
+		{
+			if (memory.device_memory != VK_NULL_HANDLE)
+				vkFreeMemory(this->device, memory.device_memory, nullptr);
+		}
+
+		this->pools.clear();
+		this->dedicated.clear();
+		this->recycled_dedicated.clear();
+		this->device_memory_count = 0;
+	}
+
+	uint32_t memory_allocator::find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties) const
+	{
+		for (uint32_t i = 0; i < this->memory_properties.memoryTypeCount; ++i)
+		{
+			if (type_filter & (1 << i) && (this->memory_properties.memoryTypes[i].propertyFlags & properties) == properties)
+				return i;
+		}
+
+		return invalid_index;
+	}
+
+	uint32_t memory_allocator::get_pool(uint32_t memory_type, bool linear)
+	{
+		for (uint32_t i = 0; i < this->pools.size(); ++i)
+		{
+			if (this->pools[i].memory_type == memory_type && this->pools[i].linear == linear)
+				return i;
+		}
+
+		memory_pool pool;
+		pool.memory_type = memory_type;
+		pool.linear = linear;
+
+		for (auto& fl : pool.heads)
+			for (auto& head : fl)
+				head = invalid_index;
+
+		this->pools.push_back(pool);
+		return static_cast<uint32_t>(this->pools.size() - 1);
+	}
+
+	bool memory_allocator::allocate_device_memory(uint32_t memory_type, VkDeviceSize size, VkDeviceMemory& device_memory, uint8_t*& mapped)
+	{
+		if (this->device_memory_count >= this->max_allocation_count)
+		{
+			std::cout << "maxMemoryAllocationCount (" << this->max_allocation_count << ") reached" << std::endl;
+			return false;
+		}
+
+		VkMemoryAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = size;
+		alloc_info.memoryTypeIndex = memory_type;
+
+		if (vkAllocateMemory(this->device, &alloc_info, nullptr, &device_memory) != VK_SUCCESS)
+			return false;
+
+		mapped = nullptr;
+
+		if (this->memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		{
+			void* data = nullptr;
+			if (vkMapMemory(this->device, device_memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+			{
+				vkFreeMemory(this->device, device_memory, nullptr);
+				return false;
+			}
+			mapped = static_cast<uint8_t*>(data);
+		}
+
+		++this->device_memory_count;
+		return true;
+	}
+
+	bool memory_allocator::allocate_dedicated(uint32_t memory_type, const VkMemoryRequirements& requirements, allocation& out)
+	{
+		dedicated_memory memory;
+		memory.memory_type = memory_type;
+		memory.size = requirements.size;
+
+		uint8_t* mapped = nullptr;
+		if (!allocate_device_memory(memory_type, requirements.size, memory.device_memory, mapped))
+			return false;
+
+		uint32_t index;
+		if (!this->recycled_dedicated.empty())
+		{
+			index = this->recycled_dedicated.back();
+			this->recycled_dedicated.pop_back();
+			this->dedicated[index] = memory;
+		}
+		else
+		{
+			index = static_cast<uint32_t>(this->dedicated.size());
+			this->dedicated.push_back(memory);
+		}
+
+		out = {};
+		out.device_memory = memory.device_memory;
+		out.offset = 0;
+		out.size = requirements.size;
+		out.mapped = mapped;
+		out.block = index;
+		out.range_size = requirements.size;
+		out.dedicated = true;
+
+		return true;
+	}
+
+	bool memory_allocator::add_block(memory_pool& pool, VkDeviceSize min_size)
+	{
+		memory_block block;
+		block.size = std::max(this->preferred_block_size, min_size);
+
+		if (!allocate_device_memory(pool.memory_type, block.size, block.device_memory, block.mapped))
+			return false;
+
+		// Reuse the slot of a released block, allocations keep indices into this vector
+		uint32_t index = static_cast<uint32_t>(pool.blocks.size());
+		for (uint32_t i = 0; i < pool.blocks.size(); ++i)
+		{
+			if (pool.blocks[i].device_memory == VK_NULL_HANDLE)
+			{
+				index = i;
+				break;
+			}
+		}
+
+		if (index == pool.blocks.size())
+			pool.blocks.push_back(block);
+		else
+			pool.blocks[index] = block;
+
+		insert_range(pool, index, 0, block.size);
+
+		return true;
+	}
+
+	void memory_allocator::release_block(memory_pool& pool, uint32_t block_index)
+	{
+		auto& block = pool.blocks[block_index];
+
+		std::vector<uint32_t> nodes;
+		for (const auto& range : block.free_ranges)
+			nodes.push_back(range.second);
+
+		for (const auto node : nodes)
+			remove_range(pool, node);
+
+		vkFreeMemory(this->device, block.device_memory, nullptr);
+		--this->device_memory_count;
+
+		block = memory_block();
+	}
+
+	uint32_t memory_allocator::insert_range(memory_pool& pool, uint32_t block, VkDeviceSize offset, VkDeviceSize size)
+	{
+		uint32_t node;
+		if (!pool.recycled_nodes.empty())
+		{
+			node = pool.recycled_nodes.back();
+			pool.recycled_nodes.pop_back();
+		}
+		else
+		{
+			node = static_cast<uint32_t>(pool.nodes.size());
+			pool.nodes.emplace_back();
+		}
+
+		const uint32_t fl = bit_scan_reverse(size);
+		const uint32_t sl = static_cast<uint32_t>((size >> (fl - sl_bits)) ^ (1ull << sl_bits));
+
+		auto& range = pool.nodes[node];
+		range.offset = offset;
+		range.size = size;
+		range.block = block;
+		range.prev = invalid_index;
+		range.next = pool.heads[fl][sl];
+
+		if (range.next != invalid_index)
+			pool.nodes[range.next].prev = node;
+
+		pool.heads[fl][sl] = node;
+		pool.fl_bitmap |= 1ull << fl;
+		pool.sl_bitmap[fl] |= 1u << sl;
+
+		pool.blocks[block].free_ranges[offset] = node;
+
+		return node;
+	}
+
+	void memory_allocator::remove_range(memory_pool& pool, uint32_t node)
+	{
+		auto& range = pool.nodes[node];
+
+		const uint32_t fl = bit_scan_reverse(range.size);
+		const uint32_t sl = static_cast<uint32_t>((range.size >> (fl - sl_bits)) ^ (1ull << sl_bits));
+
+		if (range.prev != invalid_index)
+			pool.nodes[range.prev].next = range.next;
+		else
+			pool.heads[fl][sl] = range.next;
+
+		if (range.next != invalid_index)
+			pool.nodes[range.next].prev = range.prev;
+
+		if (pool.heads[fl][sl] == invalid_index)
+		{
+			pool.sl_bitmap[fl] &= ~(1u << sl);
+			if (pool.sl_bitmap[fl] == 0)
+				pool.fl_bitmap &= ~(1ull << fl);
+		}
+
+		pool.blocks[range.block].free_ranges.erase(range.offset);
+		pool.recycled_nodes.push_back(node);
+	}
+
+	uint32_t memory_allocator::find_range(const memory_pool& pool, VkDeviceSize size) const
+	{
+		// Round up to the next bin boundary so that any range in the found bin fits
+		size += (1ull << (bit_scan_reverse(size) - sl_bits)) - 1;
+
+		uint32_t fl = bit_scan_reverse(size);
+		uint32_t sl = static_cast<uint32_t>((size >> (fl - sl_bits)) ^ (1ull << sl_bits));
+
+		uint32_t sl_map = pool.sl_bitmap[fl] & (~0u << sl);
+		if (sl_map == 0)
+		{
+			const uint64_t fl_map = fl + 1 < fl_count ? pool.fl_bitmap & (~0ull << (fl + 1)) : 0;
+			if (fl_map == 0)
+				return invalid_index;
+
+			fl = bit_scan_forward(fl_map);
+			sl_map = pool.sl_bitmap[fl];
+		}
+
+		sl = bit_scan_forward(sl_map);
+		return pool.heads[fl][sl];
+	}
+
+	bool memory_allocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, allocation& out)
+	{
+		const uint32_t memory_type = find_memory_type(requirements.memoryTypeBits, properties);
+		if (memory_type == invalid_index)
+		{
+			std::cout << "No memory type found for properties " << properties << std::endl;
+			return false;
+		}
+
+		// Big resources would waste most of a block, give them their own memory
+		if (requirements.size > this->preferred_block_size / 2)
+			return allocate_dedicated(memory_type, requirements, out);
+
+		const uint32_t pool_index = get_pool(memory_type, linear);
+		auto& pool = this->pools[pool_index];
+
+		const VkDeviceSize alignment = std::max(requirements.alignment, static_cast<VkDeviceSize>(1));
+		const VkDeviceSize size = std::max(requirements.size, min_range_size);
+		const VkDeviceSize search_size = size + alignment - 1;
+
+		uint32_t node = find_range(pool, search_size);
+		if (node == invalid_index)
+		{
+			if (!add_block(pool, search_size))
+				return false;
+
+			node = find_range(pool, search_size);
+			if (node == invalid_index)
+				return false;
+		}
+
+		const free_range range = pool.nodes[node];
+		remove_range(pool, node);
+
+		const VkDeviceSize aligned_offset = align_up(range.offset, alignment);
+		const VkDeviceSize end = aligned_offset + size;
+		const VkDeviceSize range_end = range.offset + range.size;
+
+		VkDeviceSize used_offset = range.offset;
+		VkDeviceSize used_end = range_end;
+
+		if (aligned_offset - range.offset >= min_range_size)
+		{
+			insert_range(pool, range.block, range.offset, aligned_offset - range.offset);
+			used_offset = aligned_offset;
+		}
+
+		if (range_end - end >= min_range_size)
+		{
+			insert_range(pool, range.block, end, range_end - end);
+			used_end = end;
+		}
+
+		auto& block = pool.blocks[range.block];
+		block.used += used_end - used_offset;
+		++block.allocation_count;
+
+		out = {};
+		out.device_memory = block.device_memory;
+		out.offset = aligned_offset;
+		out.size = requirements.size;
+		out.mapped = block.mapped != nullptr ? block.mapped + aligned_offset : nullptr;
+		out.pool = pool_index;
+		out.block = range.block;
+		out.range_offset = used_offset;
+		out.range_size = used_end - used_offset;
+
+		return true;
+	}
+
+	void memory_allocator::free(allocation& alloc)
+	{
+		if (alloc.device_memory == VK_NULL_HANDLE)
+			return;
+
+		if (alloc.dedicated)
+		{
+			vkFreeMemory(this->device, alloc.device_memory, nullptr);
+			--this->device_memory_count;
+
+			this->dedicated[alloc.block] = dedicated_memory();
+			this->recycled_dedicated.push_back(alloc.block);
+
+			alloc = {};
+			return;
+		}
+
+		auto& pool = this->pools[alloc.pool];
+		auto& block = pool.blocks[alloc.block];
+
+		VkDeviceSize offset = alloc.range_offset;
+		VkDeviceSize size = alloc.range_size;
+
+		block.used -= size;
+		--block.allocation_count;
+
+		// Merge with the free neighbours on both sides
+		auto next = block.free_ranges.lower_bound(offset);
+		if (next != block.free_ranges.begin())
+		{
+			const auto prev = std::prev(next);
+			const auto& prev_range = pool.nodes[prev->second];
+			if (prev_range.offset + prev_range.size == offset)
+			{
+				offset = prev_range.offset;
+				size += prev_range.size;
+				remove_range(pool, prev->second);
+			}
+		}
+
+		next = block.free_ranges.find(offset + size);
+		if (next != block.free_ranges.end())
+		{
+			size += pool.nodes[next->second].size;
+			remove_range(pool, next->second);
+		}
+
+		const uint32_t block_index = alloc.block;
+		insert_range(pool, block_index, offset, size);
+
+		// Keep one empty block around per pool to avoid allocation churn, give the rest back
+		if (block.allocation_count == 0)
+		{
+			for (uint32_t i = 0; i < pool.blocks.size(); ++i)
+			{
+				if (i != block_index && pool.blocks[i].device_memory != VK_NULL_HANDLE && pool.blocks[i].allocation_count == 0)
+				{
+					release_block(pool, block_index);
+					break;
+				}
+			}
+		}
+
+		alloc = {};
+	}
+
+	std::vector<heap_stats> memory_allocator::get_stats() const
+	{
+		std::vector<heap_stats> stats(this->memory_properties.memoryHeapCount);
+
+		for (uint32_t i = 0; i < this->memory_properties.memoryHeapCount; ++i)
+			stats[i].heap_size = this->memory_properties.memoryHeaps[i].size;
+
+		for (const auto& pool : this->pools)
+		{
+			auto& heap = stats[this->memory_properties.memoryTypes[pool.memory_type].heapIndex];
+
+			for (const auto& block : pool.blocks)
+			{
+				if (block.device_memory == VK_NULL_HANDLE)
+					continue;
+
+				heap.reserved_bytes += block.size;
+				heap.used_bytes += block.used;
+				heap.allocation_count += block.allocation_count;
+				heap.device_memory_count++;
+				heap.free_range_count += static_cast<uint32_t>(block.free_ranges.size());
+
+				for (const auto& range : block.free_ranges)
+					heap.largest_free_range = std::max(heap.largest_free_range, pool.nodes[range.second].size);
+			}
+		}
+
+		for (const auto& memory : this->dedicated)
+		{
+			if (memory.device_memory == VK_NULL_HANDLE)
+				continue;
+
+			auto& heap = stats[this->memory_properties.memoryTypes[memory.memory_type].heapIndex];
+			heap.reserved_bytes += memory.size;
+			heap.used_bytes += memory.size;
+			heap.allocation_count++;
+			heap.device_memory_count++;
+		}
+
+		return stats;
+	}
+
+	void memory_allocator::print_stats() const
+	{
+		const auto stats = get_stats();
+
+		std::cout << "Device Memory (" << this->device_memory_count << " / " << this->max_allocation_count << " allocations)" << std::endl;
+
+		for (size_t i = 0; i < stats.size(); ++i)
+		{
+			const auto& heap = stats[i];
+			if (heap.device_memory_count == 0)
+				continue;
+
+			std::cout << "\tHeap " << i
+				<< " : used " << (heap.used_bytes >> 10) << " KiB"
+				<< " / reserved " << (heap.reserved_bytes >> 10) << " KiB"
+				<< " / size " << (heap.heap_size >> 20) << " MiB"
+				<< ", " << heap.allocation_count << " allocations in " << heap.device_memory_count << " device memories"
+				<< ", " << heap.free_range_count << " free ranges"
+				<< ", fragmentation " << heap.fragmentation() << std::endl;
+		}
+	}
+}
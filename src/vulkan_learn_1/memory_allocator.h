@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace renderer
+{
+	struct allocation
+	{
+		VkDeviceMemory device_memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		uint8_t* mapped = nullptr; // only for host visible memory, stays mapped for the lifetime of the block
+
+		// Bookkeeping for free(), the range can be larger than size because of alignment padding
+		uint32_t pool = UINT32_MAX;
+		uint32_t block = 0;
+		VkDeviceSize range_offset = 0;
+		VkDeviceSize range_size = 0;
+		bool dedicated = false;
+	};
+
+	struct heap_stats
+	{
+		VkDeviceSize heap_size = 0;
+		VkDeviceSize reserved_bytes = 0;	// taken from the driver with vkAllocateMemory
+		VkDeviceSize used_bytes = 0;		// handed out to resources, padding included
+		VkDeviceSize largest_free_range = 0;
+		uint32_t device_memory_count = 0;
+		uint32_t allocation_count = 0;
+		uint32_t free_range_count = 0;
+
+		// 0 when all free space is a single range, towards 1 when it is scattered in small ranges
+		float fragmentation() const
+		{
+			const auto free_bytes = reserved_bytes - used_bytes;
+			return free_bytes == 0 ? 0.0f : 1.0f - static_cast<float>(largest_free_range) / static_cast<float>(free_bytes);
+		}
+	};
+
+	// Carves resources out of large per memory type blocks instead of one vkAllocateMemory per resource.
+	// Free ranges are kept in TLSF style bins (log2 first level, linear second level) for O(1) good fit search,
+	// and in a per block offset map to merge neighbours back together on free.
+	// Linear (buffers) and non-linear (optimal images) resources never share a block, so bufferImageGranularity
+	// can't be violated between neighbours.
+	struct memory_allocator
+	{
+	public:
+		bool initialize(VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize preferred_block_size = 64ull << 20);
+		void release();
+
+		bool allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, allocation& out);
+		void free(allocation& alloc);
+
+		std::vector<heap_stats> get_stats() const;
+		void print_stats() const;
+
+	private:
+		static constexpr uint32_t invalid_index = UINT32_MAX;
+		static constexpr uint32_t sl_bits = 2;
+		static constexpr uint32_t sl_count = 1 << sl_bits;
+		static constexpr uint32_t fl_count = 64;
+		// Leftovers smaller than this stay attached to the allocation instead of becoming a free range
+		static constexpr VkDeviceSize min_range_size = 64;
+
+		struct free_range
+		{
+			VkDeviceSize offset = 0;
+			VkDeviceSize size = 0;
+			uint32_t block = 0;
+			uint32_t prev = invalid_index;
+			uint32_t next = invalid_index;
+		};
+
+		struct memory_block
+		{
+			VkDeviceMemory device_memory = VK_NULL_HANDLE;
+			VkDeviceSize size = 0;
+			VkDeviceSize used = 0;
+			uint8_t* mapped = nullptr;
+			uint32_t allocation_count = 0;
+			std::map<VkDeviceSize, uint32_t> free_ranges; // offset -> node
+		};
+
+		struct memory_pool
+		{
+			uint32_t memory_type = 0;
+			bool linear = true;
+			std::vector<memory_block> blocks;
+			std::vector<free_range> nodes;
+			std::vector<uint32_t> recycled_nodes;
+			uint32_t heads[fl_count][sl_count];
+			uint64_t fl_bitmap = 0;
+			uint32_t sl_bitmap[fl_count] = {};
+		};
+
+		struct dedicated_memory
+		{
+			VkDeviceMemory device_memory = VK_NULL_HANDLE;
+			VkDeviceSize size = 0;
+			uint32_t memory_type = 0;
+		};
+
+		uint32_t find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties) const;
+		uint32_t get_pool(uint32_t memory_type, bool linear);
+
+		bool allocate_device_memory(uint32_t memory_type, VkDeviceSize size, VkDeviceMemory& device_memory, uint8_t*& mapped);
+		bool allocate_dedicated(uint32_t memory_type, const VkMemoryRequirements& requirements, allocation& out);
+		bool add_block(memory_pool& pool, VkDeviceSize min_size);
+		void release_block(memory_pool& pool, uint32_t block_index);
+
+		uint32_t insert_range(memory_pool& pool, uint32_t block, VkDeviceSize offset, VkDeviceSize size);
+		void remove_range(memory_pool& pool, uint32_t node);
+		uint32_t find_range(const memory_pool& pool, VkDeviceSize size) const;
+
+		VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+		VkDevice device = VK_NULL_HANDLE;
+		VkPhysicalDeviceMemoryProperties memory_properties = {};
+		VkDeviceSize preferred_block_size = 0;
+		uint32_t max_allocation_count = 0;
+		uint32_t device_memory_count = 0;
+
+		std::vector<memory_pool> pools;
+		std::vector<dedicated_memory> dedicated;
+		std::vector<uint32_t> recycled_dedicated;
+	};
+}
@@ -0,0 +1,530 @@
+#include "physics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PHYSICS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC compiles AVX2 intrinsics in any function, GCC and Clang need the target enabled per function.
+// The AVX2 path is only taken when the CPU reports support, the rest of the program stays on the baseline.
+#if defined(PHYSICS_X86) && !defined(_MSC_VER)
+#define PHYSICS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define PHYSICS_TARGET_AVX2
+#endif
+
+namespace renderer
+{
+	namespace
+	{
+		enum class instruction_set
+		{
+			scalar,
+			sse2,
+			avx2,
+		};
+
+		instruction_set detect_instruction_set()
+		{
+#if defined(PHYSICS_X86) && defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 1);
+
+			// AVX needs the OS to save the ymm registers (XSAVE enabled, xmm and ymm state in XCR0)
+			const bool os_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+
+			if (os_avx)
+			{
+				__cpuidex(info, 7, 0);
+				if ((info[1] & (1 << 5)) != 0)
+					return instruction_set::avx2;
+			}
+
+			return instruction_set::sse2;
+#elif defined(PHYSICS_X86)
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") ? instruction_set::avx2 : instruction_set::sse2;
+#else
+			return instruction_set::scalar;
+#endif
+		}
+
+		instruction_set get_cpu_instruction_set()
+		{
+			static const instruction_set set = detect_instruction_set();
+			return set;
+		}
+
+		// x and y never interact, each axis is one pass over its position, velocity and force arrays
+		struct axis
+		{
+			float* position;
+			float* velocity;
+			const float* force;
+			const float* radius;
+			float acceleration;
+			float extent;
+		};
+
+		void step_scalar(const axis& a, const float& dt, const size_t& begin, const size_t& end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				float velocity = a.velocity[i] + (a.acceleration + a.force[i]) * dt;
+				float position = a.position[i] + velocity * dt;
+
+				const float lower = a.radius[i];
+				const float upper = std::max(a.extent - lower, lower);
+
+				if (position < lower)
+				{
+					position = lower;
+					velocity = std::abs(velocity);
+				}
+				else if (position > upper)
+				{
+					position = upper;
+					velocity = -std::abs(velocity);
+				}
+
+				a.position[i] = position;
+				a.velocity[i] = velocity;
+			}
+		}
+
+#if defined(PHYSICS_X86)
+		// Both return how many circles they handled, always a multiple of the vector width
+		size_t step_sse2(const axis& a, const float& dt, const size_t& count)
+		{
+			const __m128 dt4 = _mm_set1_ps(dt);
+			const __m128 acceleration = _mm_set1_ps(a.acceleration);
+			const __m128 extent = _mm_set1_ps(a.extent);
+			const __m128 sign = _mm_set1_ps(-0.0f);
+
+			const size_t end = count & ~static_cast<size_t>(3);
+
+			for (size_t i = 0; i < end; i += 4)
+			{
+				__m128 velocity = _mm_add_ps(_mm_loadu_ps(a.velocity + i), _mm_mul_ps(_mm_add_ps(acceleration, _mm_loadu_ps(a.force + i)), dt4));
+				__m128 position = _mm_add_ps(_mm_loadu_ps(a.position + i), _mm_mul_ps(velocity, dt4));
+
+				const __m128 lower = _mm_loadu_ps(a.radius + i);
+				const __m128 upper = _mm_max_ps(_mm_sub_ps(extent, lower), lower);
+
+				const __m128 below = _mm_cmplt_ps(position, lower);
+				const __m128 above = _mm_cmpgt_ps(position, upper);
+				const __m128 magnitude = _mm_andnot_ps(sign, velocity);
+
+				// |v| past the lower edge, -|v| past the upper one, unchanged in between
+				velocity = _mm_or_ps(
+					_mm_andnot_ps(_mm_or_ps(below, above), velocity),
+					_mm_or_ps(_mm_and_ps(below, magnitude), _mm_and_ps(above, _mm_or_ps(magnitude, sign))));
+				position = _mm_min_ps(_mm_max_ps(position, lower), upper);
+
+				_mm_storeu_ps(a.position + i, position);
+				_mm_storeu_ps(a.velocity + i, velocity);
+			}
+
+			return end;
+		}
+
+		PHYSICS_TARGET_AVX2 size_t step_avx2(const axis& a, const float& dt, const size_t& count)
+		{
+			const __m256 dt8 = _mm256_set1_ps(dt);
+			const __m256 acceleration = _mm256_set1_ps(a.acceleration);
+			const __m256 extent = _mm256_set1_ps(a.extent);
+			const __m256 sign = _mm256_set1_ps(-0.0f);
+
+			const size_t end = count & ~static_cast<size_t>(7);
+
+			for (size_t i = 0; i < end; i += 8)
+			{
+				__m256 velocity = _mm256_add_ps(_mm256_loadu_ps(a.velocity + i), _mm256_mul_ps(_mm256_add_ps(acceleration, _mm256_loadu_ps(a.force + i)), dt8));
+				__m256 position = _mm256_add_ps(_mm256_loadu_ps(a.position + i), _mm256_mul_ps(velocity, dt8));
+
+				const __m256 lower = _mm256_loadu_ps(a.radius + i);
+				const __m256 upper = _mm256_max_ps(_mm256_sub_ps(extent, lower), lower);
+
+				const __m256 below = _mm256_cmp_ps(position, lower, _CMP_LT_OQ);
+				const __m256 above = _mm256_cmp_ps(position, upper, _CMP_GT_OQ);
+				const __m256 magnitude = _mm256_andnot_ps(sign, velocity);
+
+				velocity = _mm256_blendv_ps(velocity, magnitude, below);
+				velocity = _mm256_blendv_ps(velocity, _mm256_or_ps(magnitude, sign), above);
+				position = _mm256_min_ps(_mm256_max_ps(position, lower), upper);
+
+				_mm256_storeu_ps(a.position + i, position);
+				_mm256_storeu_ps(a.velocity + i, velocity);
+			}
+
+			return end;
+		}
+#endif
+
+		void step_axis(const axis& a, const float& dt, const size_t& count)
+		{
+			size_t done = 0;
+
+#if defined(PHYSICS_X86)
+			switch (get_cpu_instruction_set())
+			{
+			case instruction_set::avx2:
+				done = step_avx2(a, dt, count);
+				break;
+			case instruction_set::sse2:
+				done = step_sse2(a, dt, count);
+				break;
+			default:
+				break;
+			}
+#endif
+
+			step_scalar(a, dt, done, count);
+		}
+	}
+
+	void circle_physics::resize(const size_t& count)
+	{
+		const size_t old_count = get_count();
+
+		// Ids past the new count can sit in any slot once sorted, keep the others in order
+		if (count < old_count && this->slots_sorted)
+		{
+			size_t kept = 0;
+			for (size_t k = 0; k < old_count; ++k)
+			{
+				if (ids[k] >= count)
+					continue;
+
+				position_x[kept] = position_x[k];
+				position_y[kept] = position_y[k];
+				velocity_x[kept] = velocity_x[k];
+				velocity_y[kept] = velocity_y[k];
+				force_x[kept] = force_x[k];
+				force_y[kept] = force_y[k];
+				radius[kept] = radius[k];
+				ids[kept] = ids[k];
+				++kept;
+			}
+		}
+
+		position_x.resize(count, 0.0f);
+		position_y.resize(count, 0.0f);
+		velocity_x.resize(count, 0.0f);
+		velocity_y.resize(count, 0.0f);
+		force_x.resize(count, 0.0f);
+		force_y.resize(count, 0.0f);
+		radius.resize(count, 0.0f);
+
+		// New ids take the new slots at the end
+		ids.resize(count);
+		for (size_t k = old_count; k < count; ++k)
+			ids[k] = static_cast<uint32_t>(k);
+
+		slots.resize(count);
+		for (size_t k = 0; k < count; ++k)
+			slots[ids[k]] = static_cast<uint32_t>(k);
+	}
+
+	void circle_physics::set_circle(const uint32_t& id, const glm::vec2& position, const glm::vec2& velocity, const float& r)
+	{
+		const uint32_t slot = slots[id];
+
+		position_x[slot] = position.x;
+		position_y[slot] = position.y;
+		velocity_x[slot] = velocity.x;
+		velocity_y[slot] = velocity.y;
+		radius[slot] = r;
+	}
+
+	uint32_t circle_physics::advance(const float& dt)
+	{
+		this->accumulator += dt;
+
+		uint32_t steps = 0;
+		while (this->accumulator >= this->step_dt && steps < max_steps_per_advance)
+		{
+			step(this->step_dt);
+			this->accumulator -= this->step_dt;
+			++steps;
+		}
+
+		// Time that didn't fit is dropped, the simulation slows down rather than falling further behind
+		this->accumulator = std::fmod(this->accumulator, this->step_dt);
+
+		if (steps > 0)
+		{
+			std::fill(force_x.begin(), force_x.end(), 0.0f);
+			std::fill(force_y.begin(), force_y.end(), 0.0f);
+		}
+
+		return steps;
+	}
+
+	void circle_physics::step(const float& dt)
+	{
+		// Both axes of a range in one job, it is still in cache for the second one
+		parallel_for(this->job_types.integrate, static_cast<uint32_t>(get_count()), integrate_grain, [this, &dt](uint32_t begin, uint32_t end)
+		{
+			step_axis({ position_x.data() + begin, velocity_x.data() + begin, force_x.data() + begin, radius.data() + begin, gravity.x, extent.x }, dt, end - begin);
+			step_axis({ position_y.data() + begin, velocity_y.data() + begin, force_y.data() + begin, radius.data() + begin, gravity.y, extent.y }, dt, end - begin);
+		});
+
+		if (this->collisions)
+			resolve_collisions();
+	}
+
+	void circle_physics::parallel_for(const uint32_t& type, const uint32_t& count, const uint32_t& grain, const job_system::range_job& function) const
+	{
+		if (this->jobs != nullptr)
+			this->jobs->parallel_for(type, count, grain, function);
+		else if (count > 0)
+			function(0, count);
+	}
+
+	void circle_physics::set_job_system(job_system* jobs)
+	{
+		this->jobs = jobs;
+
+		if (jobs != nullptr)
+		{
+			this->job_types.integrate = jobs->add_job_type("physics integrate");
+			this->job_types.sort = jobs->add_job_type("physics sort");
+			this->job_types.collide = jobs->add_job_type("physics collide");
+			this->job_types.write = jobs->add_job_type("physics write");
+		}
+	}
+
+	void circle_physics::sort_slots()
+	{
+		// Circles barely move in one step, after the first sort this is close to a sequential copy
+		const auto& order = this->grid.get_sorted_points();
+		const uint32_t count = static_cast<uint32_t>(order.size());
+
+		scratch.resize(count);
+		const auto permute = [this, &order, &count](std::vector<float>& values)
+		{
+			parallel_for(this->job_types.sort, count, sort_grain, [this, &order, &values](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t k = begin; k < end; ++k)
+					scratch[k] = values[order[k]];
+			});
+			values.swap(scratch);
+		};
+
+		permute(position_x);
+		permute(position_y);
+		permute(velocity_x);
+		permute(velocity_y);
+		permute(force_x);
+		permute(force_y);
+		permute(radius);
+
+		scratch_ids.resize(count);
+		parallel_for(this->job_types.sort, count, sort_grain, [this, &order](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t k = begin; k < end; ++k)
+				scratch_ids[k] = ids[order[k]];
+		});
+		ids.swap(scratch_ids);
+
+		// Every id is in exactly one slot, the ranges write disjoint entries
+		parallel_for(this->job_types.sort, count, sort_grain, [this](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t k = begin; k < end; ++k)
+				slots[ids[k]] = k;
+		});
+
+		this->slots_sorted = true;
+	}
+
+	void circle_physics::resolve_collisions()
+	{
+		typedef std::chrono::high_resolution_clock clock;
+
+		const uint32_t count = static_cast<uint32_t>(get_count());
+		const auto t_start = clock::now();
+
+		float max_radius = 0.0f;
+		for (const auto& r : radius)
+			max_radius = std::max(max_radius, r);
+
+		// The counting sort itself stays on this thread, only the permutation after it is split up
+		this->grid.build(position_x.data(), position_y.data(), count, 2.0f * max_radius);
+		sort_slots();
+
+		const auto t_built = clock::now();
+
+		// Pairs of a bucket reach at most columns + 1 buckets either way, stripes twice that wide never share a circle
+		// with the next stripe but one. An even stripe count keeps the last and the first stripe in different rounds.
+		const uint32_t bucket_count = this->grid.get_bucket_count();
+		const uint32_t stripe_buckets = std::max(2 * (this->grid.get_columns() + 1), min_stripe_buckets);
+		uint32_t stripe_count = (bucket_count / stripe_buckets) & ~1u;
+		stripe_count = std::max(stripe_count, 1u);
+
+		std::atomic<uint32_t> candidates{ 0 };
+		std::atomic<uint32_t> contacts{ 0 };
+
+		for (uint32_t round = 0; round < std::min(stripe_count, 2u); ++round)
+		{
+			parallel_for(this->job_types.collide, (stripe_count - round + 1) / 2, 1, [&](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					const uint32_t stripe = 2 * i + round;
+					const uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(stripe) * bucket_count / stripe_count);
+					const uint32_t last = static_cast<uint32_t>(static_cast<uint64_t>(stripe + 1) * bucket_count / stripe_count);
+
+					uint32_t stripe_candidates = 0;
+					uint32_t stripe_contacts = 0;
+					collide_buckets(first, last, stripe_candidates, stripe_contacts);
+
+					candidates += stripe_candidates;
+					contacts += stripe_contacts;
+				}
+			});
+		}
+
+		const auto t_end = clock::now();
+
+		this->last_collisions.candidates = candidates;
+		this->last_collisions.contacts = contacts;
+		this->last_collisions.broadphase_ms = std::chrono::duration<double, std::milli>(t_built - t_start).count();
+		this->last_collisions.narrowphase_ms = std::chrono::duration<double, std::milli>(t_end - t_built).count();
+	}
+
+	void circle_physics::collide_buckets(const uint32_t& first, const uint32_t& end, uint32_t& candidates, uint32_t& contacts)
+	{
+		spatial_hash::range ranges[6];
+
+		// Slots are in grid order now, so the ranges of the grid index the arrays directly.
+		// Gauss-Seidel: every pair once (b > a), corrections are visible to the pairs after it. Neighborhoods come from
+		// the buckets of the build, circles only move by their overlap so they stay valid.
+		for (uint32_t bucket = first; bucket < end; ++bucket)
+		{
+			const spatial_hash::range own = this->grid.get_bucket_range(bucket, bucket + 1);
+			if (own.begin == own.end)
+				continue;
+
+			const uint32_t range_count = this->grid.get_neighbor_ranges(bucket, ranges);
+
+			for (uint32_t a = own.begin; a < own.end; ++a)
+			{
+				for (uint32_t n = 0; n < range_count; ++n)
+				{
+					for (uint32_t b = std::max(ranges[n].begin, a + 1); b < ranges[n].end; ++b)
+					{
+						++candidates;
+
+						const float dx = position_x[b] - position_x[a];
+						const float dy = position_y[b] - position_y[a];
+						const float min_distance = radius[a] + radius[b];
+						const float distance_sq = dx * dx + dy * dy;
+
+						if (distance_sq >= min_distance * min_distance)
+							continue;
+
+						++contacts;
+
+						// Coincident centers get an arbitrary axis
+						const float distance = std::sqrt(distance_sq);
+						const float nx = distance > 0.0f ? dx / distance : 1.0f;
+						const float ny = distance > 0.0f ? dy / distance : 0.0f;
+
+						// Mass grows with the area
+						const float wa = 1.0f / std::max(radius[a] * radius[a], 1e-6f);
+						const float wb = 1.0f / std::max(radius[b] * radius[b], 1e-6f);
+						const float w_sum = wa + wb;
+
+						const float correction = (min_distance - distance) / w_sum;
+						position_x[a] -= nx * correction * wa;
+						position_y[a] -= ny * correction * wa;
+						position_x[b] += nx * correction * wb;
+						position_y[b] += ny * correction * wb;
+
+						// Separating pairs keep their velocities
+						const float approach = (velocity_x[b] - velocity_x[a]) * nx + (velocity_y[b] - velocity_y[a]) * ny;
+						if (approach >= 0.0f)
+							continue;
+
+						const float impulse = -(1.0f + this->restitution) * approach / w_sum;
+						velocity_x[a] -= nx * impulse * wa;
+						velocity_y[a] -= ny * impulse * wa;
+						velocity_x[b] += nx * impulse * wb;
+						velocity_y[b] += ny * impulse * wb;
+					}
+				}
+			}
+		}
+	}
+
+	void circle_physics::write_positions(glm::vec2* out, const size_t& first, const size_t& count) const
+	{
+		const float t = this->accumulator;
+
+		// Sorted slots scatter into the id order, every id lands in one place so the ranges never collide
+		if (this->slots_sorted)
+		{
+			const size_t end = first + count;
+			parallel_for(this->job_types.write, static_cast<uint32_t>(get_count()), write_grain, [&](uint32_t begin, uint32_t range_end)
+			{
+				for (uint32_t k = begin; k < range_end; ++k)
+				{
+					const uint32_t id = ids[k];
+					if (id >= first && id < end)
+						out[id - first] = glm::vec2(position_x[k] + velocity_x[k] * t, position_y[k] + velocity_y[k] * t);
+				}
+			});
+
+			return;
+		}
+
+		parallel_for(this->job_types.write, static_cast<uint32_t>(count), write_grain, [&](uint32_t begin, uint32_t end)
+		{
+			size_t i = begin;
+
+#if defined(PHYSICS_X86)
+			// Bound by memory bandwidth, SSE2 is as fast as it gets here
+			const __m128 t4 = _mm_set1_ps(t);
+			float* dst = reinterpret_cast<float*>(out);
+
+			for (; i + 4 <= end; i += 4)
+			{
+				const size_t src = first + i;
+				const __m128 x = _mm_add_ps(_mm_loadu_ps(&position_x[src]), _mm_mul_ps(_mm_loadu_ps(&velocity_x[src]), t4));
+				const __m128 y = _mm_add_ps(_mm_loadu_ps(&position_y[src]), _mm_mul_ps(_mm_loadu_ps(&velocity_y[src]), t4));
+
+				_mm_storeu_ps(dst + 2 * i, _mm_unpacklo_ps(x, y));
+				_mm_storeu_ps(dst + 2 * i + 4, _mm_unpackhi_ps(x, y));
+			}
+#endif
+
+			for (; i < end; ++i)
+			{
+				const size_t src = first + i;
+				out[i] = glm::vec2(position_x[src] + velocity_x[src] * t, position_y[src] + velocity_y[src] * t);
+			}
+		});
+	}
+
+	const char* circle_physics::get_instruction_set()
+	{
+		switch (get_cpu_instruction_set())
+		{
+		case instruction_set::avx2:
+			return "avx2";
+		case instruction_set::sse2:
+			return "sse2";
+		default:
+			return "scalar";
+		}
+	}
+}
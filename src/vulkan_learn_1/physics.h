@@ -0,0 +1,123 @@
+#pragma once
+
+#include "job_system.h"
+#include "spatial_hash.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace renderer
+{
+	// CPU circle simulation in structure of arrays form, one float array per component so a step is a handful
+	// of streaming passes the vector units can chew through 4 (SSE2) or 8 (AVX2) circles at a time.
+	// Semi-implicit Euler with a fixed time step, forces act as accelerations, circles reflect off the edges of [0, extent].
+	// Optional circle-circle collisions: spatial_hash broadphase, pairwise narrow phase weighing circles by their area.
+	// With collisions the arrays are kept in grid order (circles of one cell next to each other), so a circle's slot
+	// changes between steps. Everything taking an index outside of the arrays takes the circle id, stable from resize().
+	// With a job system the passes are split into ranges across its threads. The narrow phase runs in two rounds
+	// over stripes of grid buckets, every other stripe at once: the stripes between keep the concurrent ones apart.
+	struct circle_physics
+	{
+	public:
+		static constexpr float default_step = 1.0f / 120.0f;
+		// A long stall runs at most this many steps instead of trying to catch up
+		static constexpr uint32_t max_steps_per_advance = 8;
+
+		// Per slot
+		std::vector<float> position_x;
+		std::vector<float> position_y;
+		std::vector<float> velocity_x;
+		std::vector<float> velocity_y;
+		// Accumulated with add_force, act on every step of the next advance and are cleared after it
+		std::vector<float> force_x;
+		std::vector<float> force_y;
+		std::vector<float> radius;
+		std::vector<uint32_t> ids;
+
+		glm::vec2 gravity = glm::vec2(0.0f);
+		glm::vec2 extent = glm::vec2(0.0f);
+		float step_dt = default_step;
+
+		bool collisions = false;
+		float restitution = 1.0f; // 1 keeps every collision elastic
+
+		struct collision_stats
+		{
+			uint32_t candidates = 0;	// pairs sharing a neighborhood, before the distance test
+			uint32_t contacts = 0;
+			double broadphase_ms = 0.0;
+			double narrowphase_ms = 0.0;
+		};
+		collision_stats last_collisions; // of the last step with collisions
+
+		// Ids [0, count). New circles start at rest in the origin, the others keep their state.
+		void resize(const size_t& count);
+		size_t get_count() const
+		{
+			return position_x.size();
+		}
+
+		uint32_t get_slot(const uint32_t& id) const
+		{
+			return slots[id];
+		}
+
+		void set_circle(const uint32_t& id, const glm::vec2& position, const glm::vec2& velocity, const float& r);
+
+		void add_force(const uint32_t& id, const glm::vec2& force)
+		{
+			force_x[slots[id]] += force.x;
+			force_y[slots[id]] += force.y;
+		}
+
+		// Runs as many fixed steps as fit into dt, the remainder carries over to the next call. Returns the step count.
+		uint32_t advance(const float& dt);
+		void step(const float& dt);
+		// Pushes overlapping circles apart and exchanges the impulse of approaching pairs, part of step() when collisions is set
+		void resolve_collisions();
+
+		// Interleaved positions of ids [first, first + count), extrapolated over the time left in the accumulator
+		// so motion stays smooth when frames don't line up with steps
+		void write_positions(glm::vec2* out, const size_t& first, const size_t& count) const;
+
+		// "avx2", "sse2" or "scalar", picked once from the CPU the process runs on
+		static const char* get_instruction_set();
+
+		// Optional, nullptr runs everything on the calling thread. Adds the "physics ..." job types.
+		void set_job_system(job_system* jobs);
+
+	private:
+		// Circles per job
+		static constexpr uint32_t integrate_grain = 16384;
+		static constexpr uint32_t sort_grain = 65536;
+		static constexpr uint32_t write_grain = 65536;
+		// Smallest stripe of the narrow phase in buckets, it grows with the row length of the grid
+		static constexpr uint32_t min_stripe_buckets = 4096;
+
+		// Moves every array into grid order
+		void sort_slots();
+		// Narrow phase of the buckets [first, end), returns the candidate and contact counts
+		void collide_buckets(const uint32_t& first, const uint32_t& end, uint32_t& candidates, uint32_t& contacts);
+		void parallel_for(const uint32_t& type, const uint32_t& count, const uint32_t& grain, const job_system::range_job& function) const;
+
+		job_system* jobs = nullptr;
+		struct
+		{
+			uint32_t integrate = job_system::invalid_type;
+			uint32_t sort = job_system::invalid_type;
+			uint32_t collide = job_system::invalid_type;
+			uint32_t write = job_system::invalid_type;
+		} job_types;
+
+		float accumulator = 0.0f;
+		spatial_hash grid;
+
+		std::vector<uint32_t> slots; // per id
+		bool slots_sorted = false; // false: slot == id
+
+		std::vector<float> scratch;
+		std::vector<uint32_t> scratch_ids;
+	};
+}
@@ -0,0 +1,166 @@
+#include "pipeline_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#endif
+
+namespace renderer
+{
+	bool pipeline_cache::initialize(VkPhysicalDevice physical_device, VkDevice device, const std::string& file_name)
+	{
+		this->device = device;
+		this->file_name = file_name;
+		vkGetPhysicalDeviceProperties(physical_device, &this->properties);
+
+		std::vector<uint8_t> contents;
+		std::ifstream file(file_name, std::ios::ate | std::ios::binary);
+		if (file.is_open())
+		{
+			contents.resize(static_cast<size_t>(file.tellg()));
+			file.seekg(0);
+			file.read(reinterpret_cast<char*>(contents.data()), contents.size());
+		}
+
+		file_header header = {};
+		const uint8_t* data = nullptr;
+		size_t data_size = 0;
+
+		if (contents.size() >= sizeof(header))
+		{
+			memcpy(&header, contents.data(), sizeof(header));
+
+			if (header.magic == file_magic && header.version == file_version && header.data_size == contents.size() - sizeof(header))
+			{
+				data = contents.data() + sizeof(header);
+				data_size = static_cast<size_t>(header.data_size);
+				this->cold_creation_ms = header.cold_creation_ms;
+			}
+		}
+
+		if (data != nullptr && !is_compatible(data, data_size))
+		{
+			std::cout << "Pipeline cache " << file_name << " is from another device or driver, starting empty" << std::endl;
+			data = nullptr;
+			data_size = 0;
+			this->cold_creation_ms = 0.0;
+		}
+
+		VkPipelineCacheCreateInfo create_info = {};
+		create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		create_info.initialDataSize = data_size;
+		create_info.pInitialData = data;
+
+		if (vkCreatePipelineCache(device, &create_info, nullptr, &this->cache) != VK_SUCCESS)
+			return false;
+
+		this->loaded = data != nullptr;
+		if (this->loaded)
+			std::cout << "Pipeline cache: " << data_size << " bytes from " << file_name << std::endl;
+
+		return true;
+	}
+
+	bool pipeline_cache::is_compatible(const uint8_t* data, const size_t& size) const
+	{
+		// VkPipelineCacheHeaderVersionOne, the only header version Vulkan 1.0 defines
+		struct vulkan_header
+		{
+			uint32_t header_size;
+			uint32_t header_version;
+			uint32_t vendor_id;
+			uint32_t device_id;
+			uint8_t uuid[VK_UUID_SIZE];
+		};
+
+		vulkan_header header;
+		if (size < sizeof(header))
+			return false;
+
+		memcpy(&header, data, sizeof(header));
+
+		return header.header_size >= sizeof(header)
+			&& header.header_version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+			&& header.vendor_id == this->properties.vendorID
+			&& header.device_id == this->properties.deviceID
+			&& memcmp(header.uuid, this->properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+
+	void pipeline_cache::report_creation_time(const double& ms)
+	{
+		// The first run without a usable cache sets the baseline the later ones are compared with
+		if (!this->loaded || this->cold_creation_ms <= 0.0)
+		{
+			this->cold_creation_ms = ms;
+			std::cout << "Pipelines created in " << ms << " ms without a cache" << std::endl;
+			return;
+		}
+
+		std::cout << "Pipelines created in " << ms << " ms from the cache, " << this->cold_creation_ms << " ms without it ("
+			<< this->cold_creation_ms - ms << " ms saved)" << std::endl;
+	}
+
+	bool pipeline_cache::save()
+	{
+		if (this->cache == VK_NULL_HANDLE)
+			return false;
+
+		size_t data_size = 0;
+		if (vkGetPipelineCacheData(this->device, this->cache, &data_size, nullptr) != VK_SUCCESS)
+			return false;
+
+		std::vector<uint8_t> contents(sizeof(file_header) + data_size);
+		if (vkGetPipelineCacheData(this->device, this->cache, &data_size, contents.data() + sizeof(file_header)) != VK_SUCCESS)
+			return false;
+
+		file_header header = {};
+		header.magic = file_magic;
+		header.version = file_version;
+		header.data_size = data_size;
+		header.cold_creation_ms = this->cold_creation_ms;
+		memcpy(contents.data(), &header, sizeof(header));
+
+		const std::string temp_name = this->file_name + ".tmp";
+		{
+			std::ofstream file(temp_name, std::ios::binary | std::ios::trunc);
+			if (!file.write(reinterpret_cast<const char*>(contents.data()), sizeof(file_header) + data_size))
+			{
+				std::cout << "Couldn't write " << temp_name << std::endl;
+				return false;
+			}
+		}
+
+		// Readers see the old file or the new one, never half of one
+#ifdef _WIN32
+		const bool renamed = MoveFileExA(temp_name.c_str(), this->file_name.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		const bool renamed = std::rename(temp_name.c_str(), this->file_name.c_str()) == 0;
+#endif
+		if (!renamed)
+		{
+			std::cout << "Couldn't replace " << this->file_name << std::endl;
+			std::remove(temp_name.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+	void pipeline_cache::release()
+	{
+		if (this->device == VK_NULL_HANDLE)
+			return;
+
+		vkDestroyPipelineCache(this->device, this->cache, nullptr);
+		this->cache = VK_NULL_HANDLE;
+		this->device = VK_NULL_HANDLE;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+
+namespace renderer
+{
+	// VkPipelineCache kept in a file between runs, so the driver only compiles the pipelines once.
+	// The file is a small header of our own followed by the data of vkGetPipelineCacheData. Data from another
+	// vendor, device or driver (pipelineCacheUUID) is thrown away instead of handed to the driver, which is free
+	// to crash on it. The header also remembers how long the pipelines took without a cache, to report the saving.
+	// save() writes a temporary file next to the cache and renames it over the old one, a crash mid write leaves
+	// the previous cache intact.
+	struct pipeline_cache
+	{
+	public:
+		// Starts empty when the file is missing or doesn't match this device, only fails when the cache can't be created
+		bool initialize(VkPhysicalDevice physical_device, VkDevice device, const std::string& file_name);
+		bool save();
+		void release();
+
+		VkPipelineCache get() const
+		{
+			return cache;
+		}
+
+		// Time the pipelines of this run took to create, logged against the time they took without a cache
+		void report_creation_time(const double& ms);
+
+	private:
+		static constexpr uint32_t file_magic = 0x43504c56; // "VLPC"
+		static constexpr uint32_t file_version = 1;
+
+		struct file_header
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint64_t data_size;
+			double cold_creation_ms; // 0 until a run without a usable cache measured it
+		};
+
+		bool is_compatible(const uint8_t* data, const size_t& size) const;
+
+		VkDevice device = VK_NULL_HANDLE;
+		VkPipelineCache cache = VK_NULL_HANDLE;
+		VkPhysicalDeviceProperties properties = {};
+
+		std::string file_name;
+		bool loaded = false;
+		double cold_creation_ms = 0.0;
+	};
+}
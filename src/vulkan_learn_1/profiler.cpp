@@ -0,0 +1,386 @@
+#include "profiler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+
+namespace renderer
+{
+	bool profiler::initialize(
+		VkPhysicalDevice physical_device,
+		VkDevice device,
+		uint32_t queue_family,
+		VkQueue queue,
+		uint32_t frames_in_flight,
+		uint32_t history_size)
+	{
+		this->device = device;
+		this->frames_in_flight = frames_in_flight;
+		this->history_size = history_size;
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physical_device, &properties);
+		this->timestamp_period_ns = properties.limits.timestampPeriod;
+
+		uint32_t family_count = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, nullptr);
+		std::vector<VkQueueFamilyProperties> families(family_count);
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, families.data());
+
+		// Durations are taken between two timestamps of the same queue, wrapping at the narrowest counter in use
+		uint32_t min_valid_bits = 64;
+		for (const auto& family : families)
+		{
+			this->timestamp_valid_bits.push_back(family.timestampValidBits);
+			if (family.timestampValidBits > 0)
+				min_valid_bits = std::min(min_valid_bits, family.timestampValidBits);
+		}
+		this->timestamp_mask = min_valid_bits >= 64 ? ~0ull : (1ull << min_valid_bits) - 1;
+
+		this->submitted.assign(frames_in_flight, false);
+		this->query_results.resize(max_gpu_scopes * 2 * 2);
+
+		if (!supports_timestamps(queue_family))
+		{
+			std::cout << "Timestamps not supported on queue family " << queue_family << ", GPU scopes disabled" << std::endl;
+			return true;
+		}
+
+		VkQueryPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		pool_info.queryCount = frames_in_flight * max_gpu_scopes * 2;
+
+		if (vkCreateQueryPool(device, &pool_info, nullptr, &this->query_pool) != VK_SUCCESS)
+			return false;
+
+		return calibrate(queue, queue_family);
+	}
+
+	void profiler::release()
+	{
+		if (this->device == VK_NULL_HANDLE)
+			return;
+
+		vkDestroyQueryPool(this->device, this->query_pool, nullptr);
+		this->query_pool = VK_NULL_HANDLE;
+		this->device = VK_NULL_HANDLE;
+	}
+
+	bool profiler::calibrate(VkQueue queue, uint32_t queue_family)
+	{
+		VkCommandPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.queueFamilyIndex = queue_family;
+		pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+		VkCommandPool command_pool;
+		if (vkCreateCommandPool(this->device, &pool_info, nullptr, &command_pool) != VK_SUCCESS)
+			return false;
+
+		VkCommandBufferAllocateInfo cmd_info = {};
+		cmd_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cmd_info.commandPool = command_pool;
+		cmd_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		cmd_info.commandBufferCount = 1;
+
+		VkCommandBuffer command_buffer;
+		VkFence fence = VK_NULL_HANDLE;
+
+		VkFenceCreateInfo fence_info = {};
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		bool result = vkAllocateCommandBuffers(this->device, &cmd_info, &command_buffer) == VK_SUCCESS
+			&& vkCreateFence(this->device, &fence_info, nullptr, &fence) == VK_SUCCESS;
+
+		if (result)
+		{
+			VkCommandBufferBeginInfo begin_info = {};
+			begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+			// Slot 0 gets reset again by the first frame that uses it
+			vkBeginCommandBuffer(command_buffer, &begin_info);
+			vkCmdResetQueryPool(command_buffer, this->query_pool, 0, 1);
+			vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, this->query_pool, 0);
+			vkEndCommandBuffer(command_buffer);
+
+			VkSubmitInfo submit_info = {};
+			submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submit_info.commandBufferCount = 1;
+			submit_info.pCommandBuffers = &command_buffer;
+
+			// The timestamp lands somewhere between the submit and the fence wait returning, take the middle
+			const auto cpu_before = clock::now();
+			result = vkQueueSubmit(queue, 1, &submit_info, fence) == VK_SUCCESS
+				&& vkWaitForFences(this->device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max()) == VK_SUCCESS;
+			const auto cpu_after = clock::now();
+
+			uint64_t gpu_ticks = 0;
+			if (result && vkGetQueryPoolResults(this->device, this->query_pool, 0, 1, sizeof(gpu_ticks), &gpu_ticks, sizeof(gpu_ticks),
+				VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS)
+			{
+				const double cpu_ns = 0.5 * (std::chrono::duration<double, std::nano>(cpu_before.time_since_epoch()).count()
+					+ std::chrono::duration<double, std::nano>(cpu_after.time_since_epoch()).count());
+
+				this->gpu_to_cpu_offset_ns = cpu_ns - static_cast<double>(gpu_ticks) * this->timestamp_period_ns;
+			}
+		}
+
+		vkDestroyFence(this->device, fence, nullptr);
+		vkDestroyCommandPool(this->device, command_pool, nullptr);
+
+		return result;
+	}
+
+	uint32_t profiler::add_scope(const char* name, bool gpu, const char* track)
+	{
+		scope s;
+		s.name = name;
+		s.track = track != nullptr ? track : "GPU";
+		s.gpu = gpu;
+		s.samples_ms.resize(this->history_size);
+
+		if (gpu)
+		{
+			if (this->gpu_scope_count == max_gpu_scopes)
+				return invalid_scope;
+
+			s.gpu_slot = this->gpu_scope_count++;
+		}
+
+		this->scopes.push_back(s);
+		return static_cast<uint32_t>(this->scopes.size() - 1);
+	}
+
+	uint32_t profiler::add_gpu_frame_scope(const char* name)
+	{
+		scope s;
+		s.name = name;
+		s.gpu = true;
+		s.gpu_slot = invalid_scope;
+		s.samples_ms.resize(this->history_size);
+
+		this->scopes.push_back(s);
+		return static_cast<uint32_t>(this->scopes.size() - 1);
+	}
+
+	void profiler::begin_cpu(uint32_t scope)
+	{
+		this->open_scopes.push_back({ scope, clock::now() });
+	}
+
+	void profiler::end_cpu()
+	{
+		if (this->open_scopes.empty())
+			return;
+
+		const auto end = clock::now();
+		const auto open = this->open_scopes.back();
+		this->open_scopes.pop_back();
+
+		add_sample(this->scopes[open.scope], std::chrono::duration<float, std::milli>(end - open.start).count());
+		TRACE_SPAN(this->scopes[open.scope].name, open.start, end);
+	}
+
+	bool profiler::supports_timestamps(uint32_t queue_family) const
+	{
+		return queue_family < this->timestamp_valid_bits.size() && this->timestamp_valid_bits[queue_family] > 0;
+	}
+
+	uint32_t profiler::get_query(uint32_t frame, uint32_t gpu_slot) const
+	{
+		return (frame * max_gpu_scopes + gpu_slot) * 2;
+	}
+
+	void profiler::reset_gpu_frame(VkCommandBuffer command_buffer, uint32_t frame)
+	{
+		if (this->query_pool == VK_NULL_HANDLE)
+			return;
+
+		vkCmdResetQueryPool(command_buffer, this->query_pool, get_query(frame, 0), max_gpu_scopes * 2);
+	}
+
+	void profiler::begin_gpu(VkCommandBuffer command_buffer, uint32_t frame, uint32_t scope, VkPipelineStageFlagBits stage)
+	{
+		if (this->query_pool == VK_NULL_HANDLE || scope == invalid_scope || this->scopes[scope].gpu_slot == invalid_scope)
+			return;
+
+		vkCmdWriteTimestamp(command_buffer, stage, this->query_pool, get_query(frame, this->scopes[scope].gpu_slot));
+	}
+
+	void profiler::end_gpu(VkCommandBuffer command_buffer, uint32_t frame, uint32_t scope, VkPipelineStageFlagBits stage)
+	{
+		if (this->query_pool == VK_NULL_HANDLE || scope == invalid_scope || this->scopes[scope].gpu_slot == invalid_scope)
+			return;
+
+		vkCmdWriteTimestamp(command_buffer, stage, this->query_pool, get_query(frame, this->scopes[scope].gpu_slot) + 1);
+	}
+
+	double profiler::get_cpu_ns() const
+	{
+		return std::chrono::duration<double, std::nano>(clock::now().time_since_epoch()).count();
+	}
+
+	double profiler::gpu_to_cpu_ns(uint64_t timestamp) const
+	{
+		return static_cast<double>(timestamp) * this->timestamp_period_ns + this->gpu_to_cpu_offset_ns;
+	}
+
+	void profiler::mark_submitted(uint32_t frame)
+	{
+		this->submitted[frame] = true;
+	}
+
+	void profiler::collect(uint32_t frame)
+	{
+		if (this->query_pool == VK_NULL_HANDLE || !this->submitted[frame])
+			return;
+
+		this->submitted[frame] = false;
+
+		// No wait, scopes that weren't recorded this frame simply report unavailable
+		const uint32_t query_count = this->gpu_scope_count * 2;
+		if (query_count == 0)
+			return;
+
+		const auto result = vkGetQueryPoolResults(
+			this->device,
+			this->query_pool,
+			get_query(frame, 0),
+			query_count,
+			sizeof(uint64_t) * 2 * query_count,
+			this->query_results.data(),
+			sizeof(uint64_t) * 2,
+			VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+		if (result != VK_SUCCESS && result != VK_NOT_READY)
+			return;
+
+		// Offsets from the first begin seen, in ticks. Timestamps only have the valid bits, a frame spanning a wrap
+		// around gets negative offsets for what came before it.
+		uint64_t first_begin = 0;
+		int64_t earliest = 0;
+		int64_t latest = 0;
+		bool any_available = false;
+
+		const auto offset = [this, &first_begin](const uint64_t& timestamp)
+		{
+			const uint64_t ticks = (timestamp - first_begin) & this->timestamp_mask;
+			return ticks > (this->timestamp_mask >> 1) ? static_cast<int64_t>(ticks) - static_cast<int64_t>(this->timestamp_mask) - 1 : static_cast<int64_t>(ticks);
+		};
+
+		for (auto& s : this->scopes)
+		{
+			if (!s.gpu || s.gpu_slot == invalid_scope)
+				continue;
+
+			const uint64_t* begin = &this->query_results[s.gpu_slot * 4];
+			const uint64_t* end = begin + 2;
+
+			if (begin[1] == 0 || end[1] == 0)
+				continue;
+
+			const uint64_t ticks = (end[0] - begin[0]) & this->timestamp_mask;
+			const float ms = static_cast<float>(ticks * this->timestamp_period_ns * 1e-6);
+			add_sample(s, ms);
+			TRACE_GPU_SPAN(s.track, s.name, gpu_to_cpu_ns(begin[0]), gpu_to_cpu_ns(end[0]));
+
+			if (!any_available)
+				first_begin = begin[0];
+
+			earliest = std::min(earliest, offset(begin[0]));
+			latest = std::max(latest, offset(end[0]));
+			any_available = true;
+		}
+
+		if (!any_available)
+			return;
+
+		const float frame_ms = static_cast<float>((latest - earliest) * this->timestamp_period_ns * 1e-6);
+
+		for (auto& s : this->scopes)
+		{
+			if (s.gpu && s.gpu_slot == invalid_scope)
+				add_sample(s, frame_ms);
+		}
+	}
+
+	void profiler::add_sample(scope& s, float ms)
+	{
+		if (this->history_size == 0)
+			return;
+
+		s.samples_ms[s.head] = ms;
+		s.head = (s.head + 1) % this->history_size;
+		s.count = std::min(s.count + 1, this->history_size);
+	}
+
+	std::vector<profiler::scope_stats> profiler::get_stats() const
+	{
+		std::vector<scope_stats> stats;
+		std::vector<float> sorted;
+
+		for (const auto& s : this->scopes)
+		{
+			scope_stats entry;
+			entry.name = s.name;
+			entry.gpu = s.gpu;
+			entry.samples = s.count;
+
+			if (s.count > 0)
+			{
+				sorted.assign(s.samples_ms.begin(), s.samples_ms.begin() + s.count);
+				std::sort(sorted.begin(), sorted.end());
+
+				double sum = 0.0;
+				for (const auto& ms : sorted)
+					sum += ms;
+				entry.mean_ms = sum / sorted.size();
+
+				// Nearest rank
+				const auto percentile = [&sorted](const double& p)
+				{
+					const auto rank = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+					return static_cast<double>(sorted[rank]);
+				};
+
+				entry.p50_ms = percentile(0.50);
+				entry.p95_ms = percentile(0.95);
+				entry.p99_ms = percentile(0.99);
+			}
+
+			stats.push_back(entry);
+		}
+
+		return stats;
+	}
+
+	void profiler::print_stats() const
+	{
+		char line[128];
+		snprintf(line, sizeof(line), "%-4s %-22s %9s %9s %9s %9s  %s", "", "scope", "mean (ms)", "p50 (ms)", "p95 (ms)", "p99 (ms)", "samples");
+		std::cout << line << std::endl;
+
+		for (const auto& entry : get_stats())
+		{
+			if (entry.samples == 0)
+				continue;
+
+			snprintf(line, sizeof(line), "%-4s %-22s %9.3f %9.3f %9.3f %9.3f  %u",
+				entry.gpu ? "GPU" : "CPU", entry.name.c_str(), entry.mean_ms, entry.p50_ms, entry.p95_ms, entry.p99_ms, entry.samples);
+			std::cout << line << std::endl;
+		}
+	}
+
+	void profiler::reset_history()
+	{
+		for (auto& s : this->scopes)
+		{
+			s.head = 0;
+			s.count = 0;
+		}
+	}
+}
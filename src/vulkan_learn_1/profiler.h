@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace renderer
+{
+	// Named CPU and GPU scopes with the durations of the last history_size occurrences of each.
+	// CPU scopes nest and are timed with the high resolution clock. GPU scopes are a pair of timestamp queries
+	// in a slice of one query pool per frame in flight, read back without waiting once the frame's fence has signaled.
+	// GPU timestamps are moved onto the CPU clock with an offset measured once at initialization, Vulkan 1.0 has
+	// no calibrated timestamps so it is only as good as one submit round trip.
+	struct profiler
+	{
+	public:
+		static constexpr uint32_t invalid_scope = UINT32_MAX;
+		static constexpr uint32_t max_gpu_scopes = 16;
+
+		struct scope_stats
+		{
+			std::string name;
+			bool gpu = false;
+			uint32_t samples = 0;
+			double mean_ms = 0.0;
+			double p50_ms = 0.0;
+			double p95_ms = 0.0;
+			double p99_ms = 0.0;
+		};
+
+		bool initialize(
+			VkPhysicalDevice physical_device,
+			VkDevice device,
+			uint32_t queue_family,
+			VkQueue queue,
+			uint32_t frames_in_flight,
+			uint32_t history_size = 512);
+		void release();
+
+		// Ids are stable for the lifetime of the profiler, look them up once and keep them.
+		// invalid_scope when the GPU scopes are exhausted. name and track (the queue, GPU scopes only)
+		// must outlive the profiler, traces keep pointing at them.
+		uint32_t add_scope(const char* name, bool gpu, const char* track = nullptr);
+		// GPU scope without queries of its own, every collected frame adds the span from the earliest begin to the
+		// latest end of the other GPU scopes it recorded. Queues overlapping (async compute) count once, not summed.
+		uint32_t add_gpu_frame_scope(const char* name);
+
+		void begin_cpu(uint32_t scope);
+		void end_cpu(); // closes the innermost open CPU scope
+
+		// Queue families with timestampValidBits == 0 can't write timestamps at all
+		bool supports_timestamps(uint32_t queue_family) const;
+
+		// Recorded once per frame in the first command buffer that executes, outside any render pass
+		void reset_gpu_frame(VkCommandBuffer command_buffer, uint32_t frame);
+		void begin_gpu(VkCommandBuffer command_buffer, uint32_t frame, uint32_t scope, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+		void end_gpu(VkCommandBuffer command_buffer, uint32_t frame, uint32_t scope, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+		// Nanoseconds since the epoch of the high resolution clock, GPU timestamps converted with the calibrated offset
+		double get_cpu_ns() const;
+		double gpu_to_cpu_ns(uint64_t timestamp) const;
+
+		// The frame's queries were submitted, collect() may read them once its fence has signaled
+		void mark_submitted(uint32_t frame);
+		void collect(uint32_t frame);
+
+		std::vector<scope_stats> get_stats() const;
+		void print_stats() const;
+		void reset_history();
+
+	private:
+		typedef std::chrono::high_resolution_clock clock;
+
+		struct scope
+		{
+			const char* name = nullptr;
+			const char* track = nullptr;
+			bool gpu = false;
+			uint32_t gpu_slot = 0; // invalid_scope for frame spans
+			std::vector<float> samples_ms; // ring
+			uint32_t head = 0;
+			uint32_t count = 0;
+		};
+
+		struct open_scope
+		{
+			uint32_t scope;
+			clock::time_point start;
+		};
+
+		bool calibrate(VkQueue queue, uint32_t queue_family);
+		void add_sample(scope& s, float ms);
+		uint32_t get_query(uint32_t frame, uint32_t gpu_slot) const;
+
+		VkDevice device = VK_NULL_HANDLE;
+		VkQueryPool query_pool = VK_NULL_HANDLE;
+		uint32_t frames_in_flight = 0;
+		uint32_t history_size = 0;
+		uint32_t gpu_scope_count = 0;
+
+		double timestamp_period_ns = 1.0;
+		std::vector<uint32_t> timestamp_valid_bits; // per queue family
+		uint64_t timestamp_mask = ~0ull;
+
+		// GPU timestamp in ns + offset = CPU clock in ns
+		double gpu_to_cpu_offset_ns = 0.0;
+
+		std::vector<scope> scopes;
+		std::vector<open_scope> open_scopes;
+		std::vector<bool> submitted;
+		std::vector<uint64_t> query_results; // value, availability pairs of one frame
+	};
+}
@@ -1,5 +1,6 @@
 #include "renderer_helper.h"
 #include <iostream>
+#include <algorithm>
 
 namespace renderer
 {
@@ -34,8 +35,7 @@ namespace renderer
 			vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_families.data());
 
 
-			// IDEAL = Find a queue that only handled compute workloads
-			VkQueueFlags compute_family_index = VK_QUEUE_FLAG_BITS_MAX_ENUM;
+			// IDEAL = Find a queue that only handled compute workloads, so simulation can overlap rendering
 			for (auto i = 0; i < queue_families.size(); ++i)
 			{
 				const auto& queue_familiy = queue_families[i];
@@ -43,11 +43,24 @@ namespace renderer
 
 				if (queue_familiy.queueCount > 0 && (queue_familiy.queueFlags & VK_QUEUE_COMPUTE_BIT))
 				{
-					if (queue_familiy.queueFlags < compute_family_index)
-						compute_family_index = i;
+					if (!indices.compute_family.has_value()
+						|| ((queue_families[indices.compute_family.value()].queueFlags & VK_QUEUE_GRAPHICS_BIT) && !(queue_familiy.queueFlags & VK_QUEUE_GRAPHICS_BIT)))
+						indices.compute_family = i;
+				}
+			}
+
+			// DMA engines show up as families with transfer but neither graphics nor compute
+			for (auto i = 0; i < queue_families.size(); ++i)
+			{
+				const auto& queue_familiy = queue_families[i];
+				const auto flags = queue_familiy.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT);
+
+				if (queue_familiy.queueCount > 0 && flags == VK_QUEUE_TRANSFER_BIT)
+				{
+					indices.transfer_family = i;
+					break;
 				}
 			}
-			indices.compute_family = compute_family_index;
 
 			for (auto i = 0; i < queue_families.size(); ++i)
 			{
@@ -59,17 +72,22 @@ namespace renderer
 				}
 
 				VkBool32 present_support = false;
-				vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, i, surface, &present_support);
+				if (surface != VK_NULL_HANDLE)
+					vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, i, surface, &present_support);
 
 				if (queue_familiy.queueCount > 0 && present_support)
 				{
 					indices.present_family = i;
 				}
 
-				if (indices.is_complete())
+				if (indices.is_complete(surface != VK_NULL_HANDLE))
 					break;
 			}
 
+			// Graphics queues always support transfers
+			if (!indices.transfer_family.has_value())
+				indices.transfer_family = indices.graphics_family;
+
 			return indices;
 		}
 
@@ -91,12 +109,12 @@ namespace renderer
 
 		bool create_buffer(
 			VkDevice device,
-			VkPhysicalDevice physical_device,
+			memory_allocator& allocator,
 			VkDeviceSize buffer_size,
 			VkBufferUsageFlags usage,
 			VkMemoryPropertyFlags memory_properties,
-			VkBuffer& buffer,
-			VkDeviceMemory& buffer_memory)
+			buffer& buffer_out,
+			const std::vector<uint32_t>& queue_families)
 		{
 			VkBufferCreateInfo  buffer_info = {};
 
@@ -105,99 +123,108 @@ namespace renderer
 			buffer_info.size = buffer_size;
 			buffer_info.usage = usage;
 
-			if (vkCreateBuffer(device, &buffer_info, nullptr, &buffer) != VK_SUCCESS)
+			// Written on one queue and read on another without ownership transfers
+			if (queue_families.size() > 1)
+			{
+				buffer_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+				buffer_info.queueFamilyIndexCount = static_cast<uint32_t>(queue_families.size());
+				buffer_info.pQueueFamilyIndices = queue_families.data();
+			}
+
+			if (vkCreateBuffer(device, &buffer_info, nullptr, &buffer_out.buffer) != VK_SUCCESS)
 			{
 				return false;
 			}
 
 			VkMemoryRequirements memory_requirements;
-			vkGetBufferMemoryRequirements(device, buffer, &memory_requirements);
-
-			VkMemoryAllocateInfo alloc_info = {};
-			alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			vkGetBufferMemoryRequirements(device, buffer_out.buffer, &memory_requirements);
 
-			alloc_info.memoryTypeIndex = find_memory_type(
-				memory_requirements.memoryTypeBits,
-				memory_properties, physical_device);
-
-			alloc_info.allocationSize = memory_requirements.size;
-
-			if (vkAllocateMemory(device, &alloc_info, nullptr, &buffer_memory) != VK_SUCCESS)
+			if (!allocator.allocate(memory_requirements, memory_properties, true, buffer_out.memory))
 			{
+				buffer_out.destroy(device, allocator);
 				return false;
 			}
 
-			if (vkBindBufferMemory(device, buffer, buffer_memory, 0) != VK_SUCCESS)
+			if (vkBindBufferMemory(device, buffer_out.buffer, buffer_out.memory.device_memory, buffer_out.memory.offset) != VK_SUCCESS)
 			{
+				buffer_out.destroy(device, allocator);
 				return false;
 			}
 
+			buffer_out.offset = 0;
+			buffer_out.size = buffer_size;
+
 			return true;
 		}
 
-		bool copy_buffer(
+		bool create_image(
 			VkDevice device,
-			VkCommandPool stage_command_pool,
-			VkQueue queue,
-			VkBuffer& src_buffer,
-			VkBuffer& dst_buffer,
-			VkDeviceSize buffer_size)
+			memory_allocator& allocator,
+			VkExtent2D extent,
+			VkFormat format,
+			VkImageUsageFlags usage,
+			image& image_out)
 		{
-			VkCommandBuffer command_buffer;
-
-			VkCommandBufferAllocateInfo command_buffer_info = {};
-			command_buffer_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-			command_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-			command_buffer_info.commandPool = stage_command_pool;
-			command_buffer_info.commandBufferCount = 1;
-
-			if (vkAllocateCommandBuffers(device, &command_buffer_info, &command_buffer) != VK_SUCCESS)
+			VkImageCreateInfo image_info = {};
+			image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			image_info.imageType = VK_IMAGE_TYPE_2D;
+			image_info.format = format;
+			image_info.extent = { extent.width, extent.height, 1 };
+			image_info.mipLevels = 1;
+			image_info.arrayLayers = 1;
+			image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+			image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+			image_info.usage = usage;
+			image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+			if (vkCreateImage(device, &image_info, nullptr, &image_out.image) != VK_SUCCESS)
 			{
 				return false;
 			}
 
-			// Record
-			VkCommandBufferBeginInfo cmd_begin = {};
-			cmd_begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			cmd_begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-			vkBeginCommandBuffer(command_buffer, &cmd_begin);
-
-			VkBufferCopy copy_region = {};
-			copy_region.srcOffset = 0;
-			copy_region.dstOffset = 0;
-			copy_region.size = buffer_size;
-			vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, 1, &copy_region);
-
-			vkEndCommandBuffer(command_buffer);
+			VkMemoryRequirements memory_requirements;
+			vkGetImageMemoryRequirements(device, image_out.image, &memory_requirements);
 
-			// Submit
-			VkSubmitInfo cmd_submit_info = {};
-			cmd_submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-			cmd_submit_info.commandBufferCount = 1;
-			cmd_submit_info.pCommandBuffers = &command_buffer;
-			vkQueueSubmit(queue, 1, &cmd_submit_info, nullptr);
-			vkQueueWaitIdle(queue);
+			if (!allocator.allocate(memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, image_out.memory))
+			{
+				image_out.destroy(device, allocator);
+				return false;
+			}
 
-			// Free
-			vkFreeCommandBuffers(device, stage_command_pool, 1, &command_buffer);
+			if (vkBindImageMemory(device, image_out.image, image_out.memory.device_memory, image_out.memory.offset) != VK_SUCCESS)
+			{
+				image_out.destroy(device, allocator);
+				return false;
+			}
 
 			return true;
 		}
 
-		VkShaderModule create_shader_module(VkDevice device, const std::vector<char>& code)
+		bool create_ring_buffer(
+			VkDevice device,
+			memory_allocator& allocator,
+			VkDeviceSize slice_size,
+			uint32_t slice_count,
+			VkBufferUsageFlags usage,
+			ring_buffer& ring,
+			VkMemoryPropertyFlags memory_properties,
+			const std::vector<uint32_t>& queue_families)
 		{
-			VkShaderModuleCreateInfo create_info = {};
-			create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-			create_info.codeSize = code.size();
-			create_info.pCode = reinterpret_cast<const uint32_t*>(code.data());
-
-			VkShaderModule shader_module;
-
-			if (vkCreateShaderModule(device, &create_info, nullptr, &shader_module) != VK_SUCCESS)
-				std::cout << "Shader Coudn't be created" << std::endl;
-
-			return shader_module;
+			// Keep every slice start on a boundary that is safe for any offset use (vertex, uniform, storage)
+			constexpr VkDeviceSize slice_alignment = 256;
+			ring.slice_size = (std::max(slice_size, static_cast<VkDeviceSize>(1)) + slice_alignment - 1) & ~(slice_alignment - 1);
+			ring.slice_count = slice_count;
+
+			// Allocator keeps host visible memory mapped, no vkMapMemory needed here
+			return create_buffer(
+				device,
+				allocator,
+				ring.slice_size * slice_count,
+				usage,
+				memory_properties,
+				ring.data,
+				queue_families);
 		}
 	}
 }
@@ -8,8 +8,19 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "vulkan_initializers.hpp"
+#include "memory_allocator.h"
+#include "upload_manager.h"
+#include "physics.h"
+#include "pipeline_cache.h"
+#include "shader_library.h"
+#include "deletion_queue.h"
+#include "timeline_semaphore.h"
+#include "simulation_thread.h"
+#include "profiler.h"
+#include "trace.h"
 
 #include <vulkan/vulkan.h>
+#include <limits>
 #include <optional>
 #include <vector>
 #include <iostream>
@@ -27,6 +38,50 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(
 
 namespace renderer
 {
+	struct buffer
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		allocation memory;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+
+		VkDescriptorBufferInfo get_descriptor_info()
+		{
+			VkDescriptorBufferInfo info = {};
+			info.buffer = this->buffer;
+			info.offset = offset;
+			info.range = size;
+			return info;
+		}
+
+		// nullptr unless the buffer was created in host visible memory
+		void* get_mapped()
+		{
+			return memory.mapped;
+		}
+
+		void destroy(const VkDevice& device, memory_allocator& allocator)
+		{
+			vkDestroyBuffer(device, this->buffer, nullptr);
+			allocator.free(this->memory);
+			this->buffer = VK_NULL_HANDLE;
+		}
+	};
+
+	// Optimal tiling 2D image, the views and layouts are up to the owner
+	struct image
+	{
+		VkImage image = VK_NULL_HANDLE;
+		allocation memory;
+
+		void destroy(const VkDevice& device, memory_allocator& allocator)
+		{
+			vkDestroyImage(device, this->image, nullptr);
+			allocator.free(this->memory);
+			this->image = VK_NULL_HANDLE;
+		}
+	};
+
 	namespace helper
 	{
 		struct QueueFamilyIndices
@@ -34,35 +89,74 @@ namespace renderer
 			std::optional<uint32_t> graphics_family;
 			std::optional<uint32_t> present_family;
 			std::optional<uint32_t> compute_family;
+			// Transfer only family when the device has one, graphics family otherwise
+			std::optional<uint32_t> transfer_family;
 
-			bool is_complete()
+			// Headless rendering has no surface, so no present family to look for
+			bool is_complete(const bool& needs_present = true)
 			{
-				return graphics_family.has_value() && present_family.has_value() && compute_family.has_value();
+				return graphics_family.has_value() && (present_family.has_value() || !needs_present) && compute_family.has_value();
 			}
 		};
 
+		// surface may be VK_NULL_HANDLE, present_family stays empty then
 		QueueFamilyIndices find_queue_family_indices(const VkPhysicalDevice& physical_device, const VkSurfaceKHR& surface);
 
 		uint32_t find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties, VkPhysicalDevice physical_device);
 
 		bool create_buffer(
 			VkDevice device,
-			VkPhysicalDevice physical_device,
+			memory_allocator& allocator,
 			VkDeviceSize buffer_size,
 			VkBufferUsageFlags usage,
 			VkMemoryPropertyFlags memory_properties,
-			VkBuffer& buffer,
-			VkDeviceMemory& buffer_memory);
+			buffer& buffer_out,
+			const std::vector<uint32_t>& queue_families = {}); // concurrent sharing when more than one family
 
-		bool copy_buffer(
+		// Device local, single mip and layer, created in VK_IMAGE_LAYOUT_UNDEFINED
+		bool create_image(
 			VkDevice device,
-			VkCommandPool stage_command_pool,
-			VkQueue queue,
-			VkBuffer& src_buffer,
-			VkBuffer& dst_buffer,
-			VkDeviceSize buffer_size);
+			memory_allocator& allocator,
+			VkExtent2D extent,
+			VkFormat format,
+			VkImageUsageFlags usage,
+			image& image_out);
+	};
+
+	// Buffer split into one slice per frame in flight, persistently mapped when it lives in host visible memory
+	struct ring_buffer
+	{
+		renderer::buffer data;
+		VkDeviceSize slice_size = 0;
+		uint32_t slice_count = 0;
+
+		VkDeviceSize get_offset(const uint32_t& slice) const
+		{
+			return slice_size * slice;
+		}
+
+		void* get_slice(const uint32_t& slice)
+		{
+			return static_cast<uint8_t*>(data.get_mapped()) + get_offset(slice);
+		}
 
-		VkShaderModule create_shader_module(VkDevice device, const std::vector<char>& code);
+		void destroy(const VkDevice& device, memory_allocator& allocator)
+		{
+			data.destroy(device, allocator);
+		}
+	};
+
+	namespace helper
+	{
+		bool create_ring_buffer(
+			VkDevice device,
+			memory_allocator& allocator,
+			VkDeviceSize slice_size,
+			uint32_t slice_count,
+			VkBufferUsageFlags usage,
+			ring_buffer& ring,
+			VkMemoryPropertyFlags memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			const std::vector<uint32_t>& queue_families = {});
 	};
 
 	struct vertex
@@ -77,27 +171,68 @@ namespace renderer
 		std::vector<uint16_t> indices;
 	};
 
-	struct buffer
+	// Vertex buffer layout description, pipelines generate their vertex input state from it
+	struct vertex_attribute
+	{
+		uint32_t location;
+		VkFormat format;
+		uint32_t offset;
+	};
+
+	struct vertex_stream
+	{
+		uint32_t binding;
+		uint32_t stride;
+		VkVertexInputRate input_rate;
+		std::vector<vertex_attribute> attributes;
+	};
+
+	struct vertex_layout
 	{
-		VkBuffer buffer;
-		VkDeviceMemory device_memory;
-		VkDeviceSize offset;
-		VkDeviceSize size;
+		std::vector<vertex_stream> streams;
 
-		VkDescriptorBufferInfo get_descriptor_info()
+		void append_to(std::vector<VkVertexInputBindingDescription>& bindings, std::vector<VkVertexInputAttributeDescription>& attributes) const
 		{
-			VkDescriptorBufferInfo info = {};
-			info.buffer = this->buffer;
-			info.offset = offset;
-			info.range = size;
-			return info;
+			for (const auto& stream : streams)
+			{
+				bindings.push_back(initializers::vertex_input_binding_description(stream.binding, stream.stride, stream.input_rate));
+
+				for (const auto& attribute : stream.attributes)
+					attributes.push_back(initializers::vertex_input_attribute_description(stream.binding, attribute.location, attribute.format, attribute.offset));
+			}
 		}
+	};
+
+	// How the culled instance data reaches the vertex shader, values match OUTPUT_LAYOUT in cull.comp
+	enum class instance_layout
+	{
+		separate,	// float position, color and scale, one buffer binding each (24 bytes)
+		packed,		// one interleaved packed_instance binding (12 bytes)
+		pulled,		// no instance bindings, the vertex shader reads the instance storage buffers through the visible ids (4 bytes)
+	};
 
-		void destroy(const VkDevice& device)
+	inline const char* get_instance_layout_name(const instance_layout& layout)
+	{
+		switch (layout)
 		{
-			vkDestroyBuffer(device, this->buffer, nullptr);
-			vkFreeMemory(device, this->device_memory, nullptr);
+		case instance_layout::packed:
+			return "packed";
+		case instance_layout::pulled:
+			return "pulled";
+		default:
+			return "separate";
 		}
+	}
+
+	// Matches the packed output of cull.comp
+	struct packed_instance
+	{
+		// Screen space quarter pixels from the view origin, read as R16G16_SNORM. Only reaches +-8191.75 pixels, cull.comp
+		// drops circles whose center is further out (huge circles around the view, windows over 8K wide).
+		int16_t position[2];
+		uint32_t color;			// RGBA8 unorm
+		uint16_t scale;			// half float radius in world units
+		uint16_t padding;		// keeps every instance on whole words for the compute writes
 	};
 
 	struct SwapChainSupportDetails
@@ -107,31 +242,102 @@ namespace renderer
 		std::vector<VkPresentModeKHR> present_modes;
 	};
 
-	struct UniformBufferObject
+	// Push constants of shaders.vert and circle_sdf.vert, recorded into every frame's command buffer
+	struct camera_constants
 	{
-		glm::mat4 view;
-		glm::mat4 proj;
+		glm::mat4 view_proj;
+		glm::vec4 screen_to_clip;	// projection of positions already in screen space (packed instances): scale xy, offset zw
+		float zoom;
 	};
 
-	inline void get_circle_model(const size_t& num_segments, model* model_out)
+	// Matches CircleState in simulate.comp (std430)
+	struct circle_state
 	{
-		model_out->vertices.resize(num_segments + 1);
-		model_out->indices.resize(num_segments * 3);
+		glm::vec2 position;
+		glm::vec2 velocity;
+	};
+
+	// One level of detail inside a shared model, addressed like a VkDrawIndexedIndirectCommand
+	struct model_lod
+	{
+		uint32_t first_index = 0;
+		uint32_t index_count = 0;
+		int32_t vertex_offset = 0;
+		float max_radius = 0.0f; // largest on-screen radius in pixels this level is used for
+	};
+
+	constexpr uint32_t max_circle_lods = 6;
+
+	// Matches LodParams in cull.comp (std140)
+	struct LodParams
+	{
+		float max_radius;
+		uint32_t first_index;
+		uint32_t index_count;
+		int32_t vertex_offset;
+	};
+
+	// Matches FrameParams in simulate.comp and cull.comp (std140)
+	struct FrameParams
+	{
+		glm::vec2 extent;
+		float dt;
+		uint32_t count;
+		glm::vec2 view_min; // world space rectangle seen by the camera
+		glm::vec2 view_max;
+		uint32_t lod_count;
+		uint32_t padding[3];
+		LodParams lods[max_circle_lods];
+	};
 
-		float step = glm::two_pi<float>() / num_segments;
+	// Splits the arc between rim vertices a and b (b may equal the segment count, meaning vertex 0)
+	// at its midpoint, so every triangle is as wide as possible instead of a thin sliver from the center
+	inline void add_arc_triangles(std::vector<uint16_t>& indices, const uint32_t& segments, const uint32_t& a, const uint32_t& b)
+	{
+		if (b - a < 2)
+			return;
+
+		const uint32_t m = (a + b) / 2;
+
+		indices.push_back(static_cast<uint16_t>(a));
+		indices.push_back(static_cast<uint16_t>(m));
+		indices.push_back(static_cast<uint16_t>(b % segments));
 
-		model_out->vertices[0] = { {0.0f, 0.0f}, {0.5f, 0.6f, 0.7f} };
+		add_arc_triangles(indices, segments, a, m);
+		add_arc_triangles(indices, segments, m, b);
+	}
 
-		for (size_t i = 1; i < num_segments + 1; ++i)
+	// Appends one rim-only circle per entry of segments (at least 3 each) to model_out, coarsest first.
+	// max_radius keeps the distance between the polygon and the true circle under half a pixel.
+	inline void get_circle_lods(const std::vector<uint32_t>& segments, model* model_out, std::vector<model_lod>* lods_out)
+	{
+		for (size_t l = 0; l < segments.size(); ++l)
 		{
-			model_out->vertices[i] = { {glm::cos(i * step), glm::sin(i * step)}, {1.0f, 1.0f, 1.0f} };
+			const uint32_t n = segments[l];
+			const float step = glm::two_pi<float>() / n;
 
-			model_out->indices[i * 3 - 3] = 0;
-			model_out->indices[i * 3 - 2] = i;
-			model_out->indices[i * 3 - 1] = i + 1;
-		}
+			model_lod lod;
+			lod.first_index = static_cast<uint32_t>(model_out->indices.size());
+			lod.vertex_offset = static_cast<int32_t>(model_out->vertices.size());
+			lod.max_radius = l + 1 < segments.size() ? 0.5f / (1.0f - glm::cos(glm::pi<float>() / n)) : std::numeric_limits<float>::max();
 
-		model_out->indices[model_out->indices.size() - 1] = 1;
+			for (uint32_t i = 0; i < n; ++i)
+				model_out->vertices.push_back({ {glm::cos(i * step), glm::sin(i * step)}, {1.0f, 1.0f, 1.0f} });
+
+			const uint32_t third = n / 3;
+			const uint32_t two_thirds = (2 * n) / 3;
+
+			model_out->indices.push_back(0);
+			model_out->indices.push_back(static_cast<uint16_t>(third));
+			model_out->indices.push_back(static_cast<uint16_t>(two_thirds));
+
+			add_arc_triangles(model_out->indices, n, 0, third);
+			add_arc_triangles(model_out->indices, n, third, two_thirds);
+			add_arc_triangles(model_out->indices, n, two_thirds, n);
+
+			lod.index_count = static_cast<uint32_t>(model_out->indices.size()) - lod.first_index;
+			lods_out->push_back(lod);
+		}
 	}
 
 }
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "shader_library.h"
+
+#include <fstream>
+#include <iostream>
+
+// Generated by the build from src/shaders, see the CustomBuild steps of the project
+#include "../shaders/shaders.vert.h"
+#include "../shaders/shaders.frag.h"
+#include "../shaders/circle_sdf.vert.h"
+#include "../shaders/circle_sdf.frag.h"
+#include "../shaders/simulate.comp.h"
+#include "../shaders/cull.comp.h"
+#include "../shaders/shaders.pulled.vert.h"
+#include "../shaders/circle_sdf.pulled.vert.h"
+
+namespace renderer
+{
+	namespace
+	{
+		struct embedded_shader
+		{
+			const char* file_name; // of the .spv in the override directory
+			const uint32_t* code;
+			size_t size;
+		};
+
+		// In shader_id order
+		const embedded_shader embedded_shaders[] =
+		{
+			{ "shaders.vert.spv", shaders_vert, sizeof(shaders_vert) },
+			{ "shaders.frag.spv", shaders_frag, sizeof(shaders_frag) },
+			{ "circle_sdf.vert.spv", circle_sdf_vert, sizeof(circle_sdf_vert) },
+			{ "circle_sdf.frag.spv", circle_sdf_frag, sizeof(circle_sdf_frag) },
+			{ "simulate.comp.spv", simulate_comp, sizeof(simulate_comp) },
+			{ "cull.comp.spv", cull_comp, sizeof(cull_comp) },
+			{ "shaders.pulled.vert.spv", shaders_pulled_vert, sizeof(shaders_pulled_vert) },
+			{ "circle_sdf.pulled.vert.spv", circle_sdf_pulled_vert, sizeof(circle_sdf_pulled_vert) },
+		};
+
+		static_assert(sizeof(embedded_shaders) / sizeof(embedded_shaders[0]) == static_cast<size_t>(shader_id::count), "One embedded shader per shader_id");
+
+		constexpr uint32_t spirv_magic = 0x07230203;
+		// Files are looked at again after this long
+		constexpr auto poll_interval = std::chrono::milliseconds(250);
+	}
+
+	void shader_library::set_override_directory(const std::string& directory)
+	{
+		this->directory = directory;
+
+		for (size_t i = 0; i < this->overrides.size(); ++i)
+			this->overrides[i].path = directory.empty() ? std::string() : (std::filesystem::path(directory) / embedded_shaders[i].file_name).string();
+	}
+
+	VkShaderModule shader_library::create_module(VkDevice device, const shader_id& id)
+	{
+		const embedded_shader& shader = embedded_shaders[static_cast<size_t>(id)];
+		override_file& file = this->overrides[static_cast<size_t>(id)];
+
+		const uint32_t* code = shader.code;
+		size_t size = shader.size;
+		std::vector<uint32_t> file_code;
+
+		std::error_code error;
+		file.loaded = true;
+		file.exists = !file.path.empty() && std::filesystem::exists(file.path, error);
+
+		if (file.exists)
+		{
+			file.modified = std::filesystem::last_write_time(file.path, error);
+
+			std::ifstream stream(file.path, std::ios::ate | std::ios::binary);
+			const size_t file_size = stream.is_open() ? static_cast<size_t>(stream.tellg()) : 0;
+
+			if (file_size >= sizeof(uint32_t) && file_size % sizeof(uint32_t) == 0)
+			{
+				file_code.resize(file_size / sizeof(uint32_t));
+				stream.seekg(0);
+				stream.read(reinterpret_cast<char*>(file_code.data()), file_size);
+			}
+
+			// A half written file from a compiler still running looks like this too, the next change retries
+			if (!file_code.empty() && file_code[0] == spirv_magic)
+			{
+				code = file_code.data();
+				size = file_code.size() * sizeof(uint32_t);
+				std::cout << "Shader override " << file.path << std::endl;
+			}
+			else
+			{
+				std::cout << "Shader override " << file.path << " is not SPIR-V, using the embedded one" << std::endl;
+			}
+		}
+
+		VkShaderModuleCreateInfo create_info = {};
+		create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		create_info.codeSize = size;
+		create_info.pCode = code;
+
+		VkShaderModule module = VK_NULL_HANDLE;
+		if (vkCreateShaderModule(device, &create_info, nullptr, &module) != VK_SUCCESS)
+		{
+			std::cout << "Shader " << shader.file_name << " couldn't be created" << std::endl;
+			return VK_NULL_HANDLE;
+		}
+
+		return module;
+	}
+
+	bool shader_library::poll_changes()
+	{
+		if (this->directory.empty())
+			return false;
+
+		const auto now = std::chrono::steady_clock::now();
+		if (now - this->last_poll < poll_interval)
+			return false;
+		this->last_poll = now;
+
+		bool changed = false;
+
+		for (auto& file : this->overrides)
+		{
+			// Variants the renderer never built can't be stale
+			if (!file.loaded)
+				continue;
+
+			std::error_code error;
+			const bool exists = std::filesystem::exists(file.path, error);
+			const auto modified = exists ? std::filesystem::last_write_time(file.path, error) : std::filesystem::file_time_type();
+
+			// Appearing, disappearing (back to the embedded code) and rewritten files all count. The new state is kept
+			// so a change is reported once, even for a module that isn't rebuilt afterwards.
+			if (exists != file.exists || (exists && modified != file.modified))
+			{
+				file.exists = exists;
+				file.modified = modified;
+				changed = true;
+			}
+		}
+
+		return changed;
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace renderer
+{
+	enum class shader_id
+	{
+		mesh_vert,			// shaders.vert
+		mesh_frag,			// shaders.frag
+		sdf_vert,			// circle_sdf.vert
+		sdf_frag,			// circle_sdf.frag
+		simulate_comp,		// simulate.comp
+		cull_comp,			// cull.comp
+		mesh_pulled_vert,	// shaders.vert with PULLED_INSTANCES defined
+		sdf_pulled_vert,	// circle_sdf.vert with PULLED_INSTANCES defined
+		count,
+	};
+
+	// SPIR-V of the shaders in src/shaders, compiled by the build (glslangValidator --vn) into arrays linked into the
+	// binary, so startup reads no shader files. For development an override directory can hold .spv files built from
+	// the same sources (compile_shaders.bat), those replace the embedded code and are watched for changes.
+	struct shader_library
+	{
+	public:
+		// Empty: embedded shaders only
+		void set_override_directory(const std::string& directory);
+
+		// The override file when there is a valid one, the embedded code otherwise. VK_NULL_HANDLE on failure.
+		VkShaderModule create_module(VkDevice device, const shader_id& id);
+
+		// True once an override file of a module created so far changed since it was last seen. Checks the files at
+		// most a few times a second, cheap enough to call every frame.
+		bool poll_changes();
+
+	private:
+		struct override_file
+		{
+			std::string path;
+			bool loaded = false; // create_module() was called for it
+			bool exists = false;
+			std::filesystem::file_time_type modified;
+		};
+
+		std::string directory;
+		std::vector<override_file> overrides = std::vector<override_file>(static_cast<size_t>(shader_id::count));
+		std::chrono::steady_clock::time_point last_poll;
+	};
+}
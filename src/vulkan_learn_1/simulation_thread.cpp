@@ -0,0 +1,120 @@
+#include "simulation_thread.h"
+
+#include <algorithm>
+
+namespace renderer
+{
+	simulation_thread::~simulation_thread()
+	{
+		stop();
+	}
+
+	bool simulation_thread::start(circle_physics* physics, job_system* jobs)
+	{
+		stop();
+
+		this->physics = physics;
+		this->jobs = jobs;
+		if (jobs != nullptr)
+			this->interpolate_job = jobs->add_job_type("snapshot interpolate");
+
+		set_extent(physics->extent);
+
+		// No tick yet, previous and current are the same positions
+		this->last_positions.resize(physics->get_count());
+		physics->write_positions(this->last_positions.data(), 0, this->last_positions.size());
+		publish(0);
+
+		this->tick_count = 0;
+		this->late_tick_count = 0;
+		this->running = true;
+		this->thread = std::thread(&simulation_thread::loop, this);
+
+		return true;
+	}
+
+	void simulation_thread::stop()
+	{
+		if (!this->thread.joinable())
+			return;
+
+		this->running = false;
+		this->thread.join();
+	}
+
+	void simulation_thread::set_extent(const glm::vec2& extent)
+	{
+		this->extent_x.store(extent.x, std::memory_order_relaxed);
+		this->extent_y.store(extent.y, std::memory_order_relaxed);
+	}
+
+	void simulation_thread::publish(const uint64_t& tick)
+	{
+		position_snapshot& snapshot = this->snapshots.get_write();
+
+		// The positions of the last tick become previous, the buffer keeps its allocations from the last time around
+		snapshot.previous.assign(this->last_positions.begin(), this->last_positions.end());
+		snapshot.current.resize(this->physics->get_count());
+		this->physics->write_positions(snapshot.current.data(), 0, snapshot.current.size());
+		snapshot.tick = tick;
+		snapshot.time = clock::now();
+
+		this->last_positions.assign(snapshot.current.begin(), snapshot.current.end());
+
+		this->snapshots.publish();
+	}
+
+	void simulation_thread::loop()
+	{
+		const auto tick_duration = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(this->physics->step_dt));
+		auto next_tick = clock::now() + tick_duration;
+		uint64_t tick = 0;
+
+		while (this->running.load(std::memory_order_relaxed))
+		{
+			std::this_thread::sleep_until(next_tick);
+
+			const auto now = clock::now();
+			if (now > next_tick + tick_duration)
+			{
+				++this->late_tick_count;
+
+				// Far behind: drop the backlog rather than running ticks back to back to catch up
+				if (now > next_tick + tick_duration * max_late_ticks)
+					next_tick = now;
+			}
+
+			this->physics->extent = glm::vec2(this->extent_x.load(std::memory_order_relaxed), this->extent_y.load(std::memory_order_relaxed));
+			// One step exactly, nothing is left in the accumulator to extrapolate with
+			this->physics->advance(this->physics->step_dt);
+
+			publish(++tick);
+			this->tick_count.store(tick, std::memory_order_relaxed);
+
+			next_tick += tick_duration;
+		}
+	}
+
+	void simulation_thread::write_positions(glm::vec2* out, const size_t& count)
+	{
+		this->snapshots.update();
+		const position_snapshot& snapshot = this->snapshots.get_read();
+
+		// Drawn one tick behind the newest one, blended by how far into the next tick we are
+		const float tick_seconds = this->physics->step_dt;
+		const float elapsed = std::chrono::duration<float>(clock::now() - snapshot.time).count();
+		const float t = std::min(std::max(elapsed / tick_seconds, 0.0f), 1.0f);
+
+		const uint32_t available = static_cast<uint32_t>(std::min(count, snapshot.current.size()));
+		const auto blend = [&snapshot, &out, &t](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; ++i)
+				out[i] = snapshot.previous[i] + (snapshot.current[i] - snapshot.previous[i]) * t;
+		};
+
+		if (this->jobs != nullptr)
+			this->jobs->parallel_for(this->interpolate_job, available, interpolate_grain, blend);
+		else if (available > 0)
+			blend(0, available);
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "job_system.h"
+#include "physics.h"
+#include "triple_buffer.h"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace renderer
+{
+	// Positions of two consecutive ticks, the render thread blends between them
+	struct position_snapshot
+	{
+		std::vector<glm::vec2> previous;
+		std::vector<glm::vec2> current;
+		uint64_t tick = 0;
+		std::chrono::high_resolution_clock::time_point time; // when current was taken
+	};
+
+	// Runs circle_physics on a thread of its own, one fixed step per tick at 1 / step_dt ticks a second, and
+	// publishes every tick through a triple buffer. The render thread takes the latest snapshot whenever it draws
+	// and interpolates one tick behind, so neither waits for the other: a slow frame doesn't stall the simulation
+	// and a slow tick doesn't drop frames, the render thread keeps blending the last two ticks it has.
+	// The physics belong to the thread while it runs, stop() before touching them.
+	struct simulation_thread
+	{
+	public:
+		// A tick this much behind its schedule is dropped instead of caught up
+		static constexpr uint32_t max_late_ticks = 4;
+
+		~simulation_thread();
+
+		// Publishes the current state as the first snapshot, so there is always one to read
+		bool start(circle_physics* physics, job_system* jobs);
+		void stop();
+
+		bool is_running() const
+		{
+			return thread.joinable();
+		}
+
+		// Picked up at the start of the next tick
+		void set_extent(const glm::vec2& extent);
+
+		// Positions of ids [0, count) blended between the last two ticks of the newest snapshot. Render thread only.
+		void write_positions(glm::vec2* out, const size_t& count);
+
+		// Both count since the last start() and stay valid after stop()
+		uint64_t get_tick_count() const
+		{
+			return tick_count.load(std::memory_order_relaxed);
+		}
+
+		// Ticks that started more than a tick late
+		uint64_t get_late_tick_count() const
+		{
+			return late_tick_count.load(std::memory_order_relaxed);
+		}
+
+	private:
+		typedef std::chrono::high_resolution_clock clock;
+
+		static constexpr uint32_t interpolate_grain = 65536;
+
+		void loop();
+		void publish(const uint64_t& tick);
+
+		circle_physics* physics = nullptr;
+		job_system* jobs = nullptr;
+		uint32_t interpolate_job = job_system::invalid_type;
+
+		std::thread thread;
+		std::atomic<bool> running{ false };
+
+		std::atomic<float> extent_x{ 0.0f };
+		std::atomic<float> extent_y{ 0.0f };
+
+		triple_buffer<position_snapshot> snapshots;
+		std::vector<glm::vec2> last_positions; // simulation thread, current of the last published snapshot
+
+		std::atomic<uint64_t> tick_count{ 0 };
+		std::atomic<uint64_t> late_tick_count{ 0 };
+	};
+}
@@ -0,0 +1,92 @@
+#include "spatial_hash.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace renderer
+{
+	int32_t spatial_hash::cell_coordinate(const float& v, const float& origin) const
+	{
+		// Clamped, stray points far outside just share the border cells
+		return static_cast<int32_t>(std::min(std::max(std::floor((v - origin) * this->inverse_cell_size), -1e9f), 1e9f));
+	}
+
+	void spatial_hash::build(const float* x, const float* y, const size_t& count, const float& cell_size)
+	{
+		this->inverse_cell_size = 1.0f / std::max(cell_size, 1e-6f);
+
+		// Bounding box, the key is relative to its corner
+		float min_x = 0.0f, min_y = 0.0f, max_x = 0.0f;
+		if (count > 0)
+		{
+			min_x = max_x = x[0];
+			min_y = y[0];
+		}
+
+		for (size_t i = 1; i < count; ++i)
+		{
+			min_x = std::min(min_x, x[i]);
+			max_x = std::max(max_x, x[i]);
+			min_y = std::min(min_y, y[i]);
+		}
+
+		this->origin_x = min_x;
+		this->origin_y = min_y;
+		// A spare column on each side for the neighbors. Wider rows simply wrap onto the next one.
+		this->columns = std::min(static_cast<uint32_t>(cell_coordinate(max_x, min_x)) + 3, max_columns);
+
+		// About one bucket per point keeps the buckets short without the table outgrowing the cache much.
+		// At least four rows, so the three rows of a neighborhood never wrap onto each other.
+		uint32_t table_size = 1;
+		while (table_size < count || table_size < 4 * this->columns)
+			table_size <<= 1;
+		this->table_mask = table_size - 1;
+
+		this->point_bucket.resize(count);
+		this->sorted_points.resize(count);
+		this->bucket_start.assign(static_cast<size_t>(table_size) + 1, 0);
+
+		// Count, bucket_start[b + 1] holds the size of bucket b
+		for (size_t i = 0; i < count; ++i)
+		{
+			const uint32_t bucket = get_bucket(x[i], y[i]);
+			this->point_bucket[i] = bucket;
+			++this->bucket_start[bucket + 1];
+		}
+
+		// Exclusive prefix sum
+		for (uint32_t b = 0; b < table_size; ++b)
+			this->bucket_start[b + 1] += this->bucket_start[b];
+
+		// Scatter, the starts are walked forward as a write cursor and restored afterwards
+		for (size_t i = 0; i < count; ++i)
+			this->sorted_points[this->bucket_start[this->point_bucket[i]]++] = static_cast<uint32_t>(i);
+
+		for (uint32_t b = table_size; b > 0; --b)
+			this->bucket_start[b] = this->bucket_start[b - 1];
+		this->bucket_start[0] = 0;
+	}
+
+	uint32_t spatial_hash::get_neighbor_ranges(const uint32_t& bucket, range ranges[6]) const
+	{
+		uint32_t count = 0;
+
+		// Keys are linear in the cell coordinates, the cell to the left one row up is bucket - columns - 1
+		for (int32_t dy = -1; dy <= 1; ++dy)
+		{
+			const uint32_t first = (bucket + static_cast<uint32_t>(dy) * this->columns - 1) & this->table_mask;
+
+			if (first + 2 <= this->table_mask)
+			{
+				ranges[count++] = { this->bucket_start[first], this->bucket_start[first + 3] };
+			}
+			else
+			{
+				ranges[count++] = { this->bucket_start[first], this->bucket_start[this->table_mask + 1] };
+				ranges[count++] = { this->bucket_start[0], this->bucket_start[first + 3 - (this->table_mask + 1)] };
+			}
+		}
+
+		return count;
+	}
+}
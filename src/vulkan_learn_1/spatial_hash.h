@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace renderer
+{
+	// Uniform grid over the plane, cells keyed by their integer coordinates into a power of two bucket table.
+	// Rebuilt from scratch every step with a counting sort: one pass keys and counts, a prefix sum turns the
+	// counts into bucket starts, a second pass scatters the point indices. Buckets are flat ranges of one array,
+	// no per cell allocations.
+	// The key is the row major cell index inside the bounding box of the points, wrapped to the table size, so
+	// neighboring cells of a row are neighboring buckets and points sorted by bucket are sorted in space too:
+	// a 3x3 neighborhood is three contiguous runs of the sorted points.
+	// Cells far apart can wrap onto the same bucket, queries have to check the real distance.
+	struct spatial_hash
+	{
+	public:
+		struct range
+		{
+			uint32_t begin;
+			uint32_t end;
+		};
+
+		// Builds over count points. With cell_size at least twice the largest radius, two overlapping circles
+		// are always in neighboring cells.
+		void build(const float* x, const float* y, const size_t& count, const float& cell_size);
+
+		// Ranges of get_sorted_points() covering the 3x3 cells around the cell of bucket, one per row unless the row
+		// wraps around the end of the table. Returns how many were written. All of them lie within get_columns() + 1
+		// buckets of bucket, counting around the end of the table.
+		uint32_t get_neighbor_ranges(const uint32_t& bucket, range ranges[6]) const;
+
+		uint32_t get_bucket(const float& x, const float& y) const
+		{
+			return key(cell_coordinate(x, origin_x), cell_coordinate(y, origin_y));
+		}
+
+		// Range of get_sorted_points() holding buckets [first, end)
+		range get_bucket_range(const uint32_t& first, const uint32_t& end) const
+		{
+			return { bucket_start[first], bucket_start[end] };
+		}
+
+		// Point indices ordered by bucket
+		const std::vector<uint32_t>& get_sorted_points() const
+		{
+			return sorted_points;
+		}
+
+		uint32_t get_bucket_count() const
+		{
+			return table_mask + 1;
+		}
+
+		// Buckets from one row of cells to the next
+		uint32_t get_columns() const
+		{
+			return columns;
+		}
+
+	private:
+		static constexpr uint32_t max_columns = 1 << 16;
+
+		int32_t cell_coordinate(const float& v, const float& origin) const;
+		uint32_t key(const int32_t& cx, const int32_t& cy) const
+		{
+			return (static_cast<uint32_t>(cy) * columns + static_cast<uint32_t>(cx)) & table_mask;
+		}
+
+		float inverse_cell_size = 1.0f;
+		float origin_x = 0.0f;
+		float origin_y = 0.0f;
+		uint32_t columns = 1;
+		uint32_t table_mask = 0;
+
+		std::vector<uint32_t> point_bucket;	// bucket of every point, kept between the two passes
+		std::vector<uint32_t> bucket_start;	// table size + 1 entries
+		std::vector<uint32_t> sorted_points;
+	};
+}
@@ -0,0 +1,69 @@
+#include "timeline_semaphore.h"
+
+namespace renderer
+{
+	bool timeline_semaphore::initialize(VkDevice device)
+	{
+		this->device = device;
+		this->completed_value = 0;
+
+		this->wait_semaphores = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR"));
+		this->get_counter_value = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR"));
+
+		if (this->wait_semaphores == nullptr || this->get_counter_value == nullptr)
+			return false;
+
+		VkSemaphoreTypeCreateInfoKHR type_info = {};
+		type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+		type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		type_info.initialValue = 0;
+
+		VkSemaphoreCreateInfo create_info = {};
+		create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		create_info.pNext = &type_info;
+
+		return vkCreateSemaphore(device, &create_info, nullptr, &this->semaphore) == VK_SUCCESS;
+	}
+
+	void timeline_semaphore::release()
+	{
+		if (this->device == VK_NULL_HANDLE)
+			return;
+
+		vkDestroySemaphore(this->device, this->semaphore, nullptr);
+		this->semaphore = VK_NULL_HANDLE;
+		this->device = VK_NULL_HANDLE;
+	}
+
+	uint64_t timeline_semaphore::get_completed_value()
+	{
+		uint64_t value = 0;
+		if (this->get_counter_value(this->device, this->semaphore, &value) == VK_SUCCESS)
+			this->completed_value = value;
+
+		return this->completed_value;
+	}
+
+	bool timeline_semaphore::is_complete(const uint64_t& value)
+	{
+		return this->completed_value >= value || get_completed_value() >= value;
+	}
+
+	bool timeline_semaphore::wait(const uint64_t& value, const uint64_t& timeout)
+	{
+		if (this->completed_value >= value)
+			return true;
+
+		VkSemaphoreWaitInfoKHR wait_info = {};
+		wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		wait_info.semaphoreCount = 1;
+		wait_info.pSemaphores = &this->semaphore;
+		wait_info.pValues = &value;
+
+		if (this->wait_semaphores(this->device, &wait_info, timeout) != VK_SUCCESS)
+			return false;
+
+		this->completed_value = value;
+		return true;
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+
+namespace renderer
+{
+	// One VK_KHR_timeline_semaphore semaphore counting the submissions of a queue. Every submit signals a larger value
+	// (frame number, upload batch id), the CPU and the other queues wait for the value they depend on instead of
+	// a fence or a binary semaphore per submission. It starts at 0, so waiting for 0 never blocks.
+	struct timeline_semaphore
+	{
+	public:
+		// The device has to be created with the extension and its timelineSemaphore feature enabled
+		bool initialize(VkDevice device);
+		void release();
+
+		// Largest value signaled so far
+		uint64_t get_completed_value();
+		// Only queries the semaphore while the last value seen is smaller
+		bool is_complete(const uint64_t& value);
+		bool wait(const uint64_t& value, const uint64_t& timeout = UINT64_MAX);
+
+		VkSemaphore get() const
+		{
+			return semaphore;
+		}
+
+	private:
+		VkDevice device = VK_NULL_HANDLE;
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		uint64_t completed_value = 0;
+
+		// Extension entry points, the instance is created for Vulkan 1.0
+		PFN_vkWaitSemaphoresKHR wait_semaphores = nullptr;
+		PFN_vkGetSemaphoreCounterValueKHR get_counter_value = nullptr;
+	};
+}
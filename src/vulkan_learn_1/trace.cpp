@@ -0,0 +1,127 @@
+#include "trace.h"
+
+#if defined(TRACE_ENABLED)
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+namespace renderer
+{
+	trace_recorder& trace_recorder::get()
+	{
+		static trace_recorder recorder;
+		return recorder;
+	}
+
+	trace_recorder::track& trace_recorder::get_thread_track()
+	{
+		// Tracks live until the process exits, threads can finish before the trace is written
+		thread_local track* thread_track = nullptr;
+
+		if (thread_track == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+
+			thread_track = new track();
+			thread_track->name = "thread " + std::to_string(this->tracks.size());
+			this->tracks.push_back(thread_track);
+		}
+
+		return *thread_track;
+	}
+
+	trace_recorder::track& trace_recorder::get_gpu_track(const char* name)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+
+		for (auto t : this->tracks)
+		{
+			if (t->gpu && t->name == name)
+				return *t;
+		}
+
+		auto t = new track();
+		t->name = name;
+		t->gpu = true;
+		this->tracks.push_back(t);
+
+		return *t;
+	}
+
+	void trace_recorder::add_span(const char* name, clock::time_point begin, clock::time_point end)
+	{
+		auto& t = get_thread_track();
+		if (t.events.size() >= max_events_per_track)
+			return;
+
+		const double begin_ns = std::chrono::duration<double, std::nano>(begin.time_since_epoch()).count();
+		t.events.push_back({ name, begin_ns, std::chrono::duration<double, std::nano>(end - begin).count() });
+	}
+
+	void trace_recorder::add_gpu_span(const char* track_name, const char* name, double begin_ns, double end_ns)
+	{
+		auto& t = get_gpu_track(track_name);
+		if (t.events.size() >= max_events_per_track)
+			return;
+
+		t.events.push_back({ name, begin_ns, end_ns - begin_ns });
+	}
+
+	static void write_escaped(FILE* file, const char* text)
+	{
+		for (; *text; ++text)
+		{
+			if (*text == '"' || *text == '\\')
+				fputc('\\', file);
+			fputc(*text, file);
+		}
+	}
+
+	bool trace_recorder::write(const std::string& path)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+
+		FILE* file = fopen(path.c_str(), "w");
+		if (file == nullptr)
+			return false;
+
+		// Microseconds from the first event, keeps the numbers short
+		double origin_ns = std::numeric_limits<double>::max();
+		for (const auto t : this->tracks)
+		{
+			for (const auto& e : t->events)
+				origin_ns = std::min(origin_ns, e.begin_ns);
+		}
+
+		// pid 1 holds the CPU threads, pid 2 the GPU queues
+		fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+		fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"GPU\"}}");
+
+		for (size_t tid = 0; tid < this->tracks.size(); ++tid)
+		{
+			const auto& t = *this->tracks[tid];
+			const int pid = t.gpu ? 2 : 1;
+
+			fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%zu,\"args\":{\"name\":\"", pid, tid);
+			write_escaped(file, t.name.c_str());
+			fprintf(file, "\"}}");
+
+			for (const auto& e : t.events)
+			{
+				fprintf(file, ",\n{\"name\":\"");
+				write_escaped(file, e.name);
+				fprintf(file, "\",\"ph\":\"X\",\"pid\":%d,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+					pid, tid, (e.begin_ns - origin_ns) * 1e-3, e.duration_ns * 1e-3);
+			}
+		}
+
+		fprintf(file, "\n]}\n");
+
+		return fclose(file) == 0;
+	}
+}
+
+#endif
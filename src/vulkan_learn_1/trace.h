@@ -0,0 +1,82 @@
+#pragma once
+
+// Chrome trace event recording (chrome://tracing, ui.perfetto.dev).
+// Everything goes through the TRACE_* macros, which are empty unless TRACE_ENABLED is defined
+// (preprocessor definitions of the project, set for Debug), so instrumented hot paths cost nothing in Release builds.
+
+#if defined(TRACE_ENABLED)
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace renderer
+{
+	// Complete ("X") events, one track per CPU thread and one per named GPU queue.
+	// Threads append to their own buffer, the lock is only taken the first time a thread records.
+	struct trace_recorder
+	{
+	public:
+		typedef std::chrono::high_resolution_clock clock;
+
+		static trace_recorder& get();
+
+		// CPU span on the calling thread's track
+		void add_span(const char* name, clock::time_point begin, clock::time_point end);
+		// GPU span, times in nanoseconds since the clock's epoch (see profiler::gpu_to_cpu_ns)
+		void add_gpu_span(const char* track, const char* name, double begin_ns, double end_ns);
+
+		bool write(const std::string& path);
+
+	private:
+		static constexpr size_t max_events_per_track = 1 << 20;
+
+		struct event
+		{
+			const char* name; // string literals or names owned by long lived objects
+			double begin_ns;
+			double duration_ns;
+		};
+
+		struct track
+		{
+			std::string name;
+			bool gpu = false;
+			std::vector<event> events;
+		};
+
+		track& get_thread_track();
+		track& get_gpu_track(const char* name);
+
+		std::mutex mutex;
+		std::vector<track*> tracks;
+	};
+
+	struct trace_scope
+	{
+		const char* name;
+		trace_recorder::clock::time_point begin;
+
+		explicit trace_scope(const char* name) : name(name), begin(trace_recorder::clock::now()) {}
+		~trace_scope() { trace_recorder::get().add_span(name, begin, trace_recorder::clock::now()); }
+	};
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#define TRACE_SCOPE(name) renderer::trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SPAN(name, begin, end) renderer::trace_recorder::get().add_span(name, begin, end)
+#define TRACE_GPU_SPAN(track, name, begin_ns, end_ns) renderer::trace_recorder::get().add_gpu_span(track, name, begin_ns, end_ns)
+#define TRACE_WRITE(path) renderer::trace_recorder::get().write(path)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_SPAN(name, begin, end) ((void)0)
+#define TRACE_GPU_SPAN(track, name, begin_ns, end_ns) ((void)0)
+#define TRACE_WRITE(path) false
+
+#endif
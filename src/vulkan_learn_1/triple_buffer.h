@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace renderer
+{
+	// Single producer, single consumer hand-off of the latest value without locks. The writer fills its own buffer
+	// and publishes it by swapping it with the middle one, the reader swaps its buffer with the middle one when that
+	// holds something newer. Neither side ever waits for the other, the reader just skips values it was too slow for.
+	// Buffers are reused as they come around again, so a T holding vectors keeps its allocations.
+	template<typename T>
+	struct triple_buffer
+	{
+	public:
+		// Writer thread only
+		T& get_write()
+		{
+			return buffers[write_index];
+		}
+
+		void publish()
+		{
+			// acq_rel: the writes to the buffer happen before the reader can see it, and the buffer we get back
+			// is no longer read
+			write_index = middle.exchange(write_index | fresh_bit, std::memory_order_acq_rel) & index_mask;
+		}
+
+		// Reader thread only. Moves to the newest published value, returns false when there was none since the last call.
+		bool update()
+		{
+			if ((middle.load(std::memory_order_relaxed) & fresh_bit) == 0)
+				return false;
+
+			read_index = middle.exchange(read_index, std::memory_order_acq_rel) & index_mask;
+			return true;
+		}
+
+		const T& get_read() const
+		{
+			return buffers[read_index];
+		}
+
+	private:
+		static constexpr uint8_t index_mask = 3;
+		static constexpr uint8_t fresh_bit = 4;
+
+		T buffers[3];
+		uint8_t write_index = 0;
+		uint8_t read_index = 1;
+		std::atomic<uint8_t> middle{ 2 };
+	};
+}
@@ -0,0 +1,369 @@
+#include "upload_manager.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+namespace renderer
+{
+	bool upload_manager::initialize(VkDevice device, memory_allocator& allocator, uint32_t queue_family, VkQueue queue, bool timeline_semaphores, VkDeviceSize staging_size)
+	{
+		this->device = device;
+		this->allocator = &allocator;
+		this->queue_family = queue_family;
+		this->queue = queue;
+		this->staging_size = staging_size;
+		this->timeline_semaphores = timeline_semaphores;
+
+		if (timeline_semaphores && !this->timeline.initialize(device))
+			return false;
+
+		VkCommandPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.queueFamilyIndex = queue_family;
+		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+		if (vkCreateCommandPool(device, &pool_info, nullptr, &this->command_pool) != VK_SUCCESS)
+			return false;
+
+		VkCommandBufferAllocateInfo cmd_info = {};
+		cmd_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cmd_info.commandPool = this->command_pool;
+		cmd_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		cmd_info.commandBufferCount = 1;
+
+		VkFenceCreateInfo fence_info = {};
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		for (auto& b : this->batches)
+		{
+			if (vkAllocateCommandBuffers(device, &cmd_info, &b.command_buffer) != VK_SUCCESS)
+				return false;
+			if (!timeline_semaphores && vkCreateFence(device, &fence_info, nullptr, &b.fence) != VK_SUCCESS)
+				return false;
+		}
+
+		VkBufferCreateInfo buffer_info = {};
+		buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		buffer_info.size = staging_size;
+		buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+		if (vkCreateBuffer(device, &buffer_info, nullptr, &this->staging_buffer) != VK_SUCCESS)
+			return false;
+
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(device, this->staging_buffer, &requirements);
+
+		if (!allocator.allocate(requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true, this->staging_memory))
+			return false;
+
+		return vkBindBufferMemory(device, this->staging_buffer, this->staging_memory.device_memory, this->staging_memory.offset) == VK_SUCCESS;
+	}
+
+	void upload_manager::release()
+	{
+		if (this->device == VK_NULL_HANDLE)
+			return;
+
+		for (auto& b : this->batches)
+		{
+			if (b.in_flight)
+				wait_batch(b);
+
+			vkDestroyFence(this->device, b.fence, nullptr);
+			b = batch();
+		}
+
+		this->timeline.release();
+
+		for (auto semaphore : this->pending_semaphores)
+			vkDestroySemaphore(this->device, semaphore, nullptr);
+		for (auto semaphore : this->free_semaphores)
+			vkDestroySemaphore(this->device, semaphore, nullptr);
+
+		this->pending_semaphores.clear();
+		this->free_semaphores.clear();
+
+		vkDestroyCommandPool(this->device, this->command_pool, nullptr);
+
+		vkDestroyBuffer(this->device, this->staging_buffer, nullptr);
+		this->allocator->free(this->staging_memory);
+
+		this->device = VK_NULL_HANDLE;
+	}
+
+	bool upload_manager::begin_batch()
+	{
+		auto& b = this->batches[this->current_batch];
+
+		if (b.recording)
+			return true;
+
+		// Slot still owned by an older submission
+		if (b.in_flight && !wait(b.id))
+			return false;
+
+		VkCommandBufferBeginInfo begin_info = {};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		if (vkBeginCommandBuffer(b.command_buffer, &begin_info) != VK_SUCCESS)
+			return false;
+
+		b.id = this->next_batch_id++;
+		b.staging_bytes = 0;
+		b.recording = true;
+
+		return true;
+	}
+
+	bool upload_manager::allocate_staging(VkDeviceSize size, VkDeviceSize& offset)
+	{
+		// Keep copies aligned for any texel/vertex type
+		size = (size + 15) & ~static_cast<VkDeviceSize>(15);
+
+		if (size > this->staging_size)
+			return false;
+
+		retire_completed();
+
+		while (true)
+		{
+			// Allocations never wrap, the tail end of the ring is skipped instead
+			const VkDeviceSize skipped = this->staging_head + size > this->staging_size ? this->staging_size - this->staging_head : 0;
+
+			if (this->staging_used + skipped + size <= this->staging_size)
+			{
+				offset = skipped > 0 ? 0 : this->staging_head;
+				this->staging_head = offset + size;
+				this->staging_used += skipped + size;
+				this->batches[this->current_batch].staging_bytes += skipped + size;
+				return true;
+			}
+
+			// Ring is full, wait for the oldest batch to give its range back
+			uint64_t oldest = 0;
+			for (const auto& b : this->batches)
+			{
+				if (b.in_flight && (oldest == 0 || b.id < oldest))
+					oldest = b.id;
+			}
+
+			if (oldest == 0)
+			{
+				// Everything left is owned by the batch being recorded
+				if (this->batches[this->current_batch].staging_bytes == 0)
+					return false;
+
+				oldest = flush();
+				if (!begin_batch())
+					return false;
+			}
+
+			if (!wait(oldest))
+				return false;
+		}
+	}
+
+	bool upload_manager::upload(VkBuffer dst_buffer, VkDeviceSize dst_offset, const void* data, VkDeviceSize size)
+	{
+		// Big uploads go through the ring in pieces
+		const VkDeviceSize chunk_size = this->staging_size / 4;
+
+		while (size > 0)
+		{
+			const VkDeviceSize chunk = std::min(size, chunk_size);
+
+			if (!begin_batch())
+				return false;
+
+			VkDeviceSize staging_offset = 0;
+			if (!allocate_staging(chunk, staging_offset))
+			{
+				std::cout << "Upload of " << chunk << " bytes doesn't fit in the staging ring" << std::endl;
+				return false;
+			}
+
+			memcpy(this->staging_memory.mapped + staging_offset, data, static_cast<size_t>(chunk));
+
+			VkBufferCopy region = {};
+			region.srcOffset = staging_offset;
+			region.dstOffset = dst_offset;
+			region.size = chunk;
+			vkCmdCopyBuffer(this->batches[this->current_batch].command_buffer, this->staging_buffer, dst_buffer, 1, &region);
+
+			data = static_cast<const uint8_t*>(data) + chunk;
+			dst_offset += chunk;
+			size -= chunk;
+		}
+
+		return true;
+	}
+
+	bool upload_manager::copy(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size, VkDeviceSize src_offset, VkDeviceSize dst_offset)
+	{
+		if (!begin_batch())
+			return false;
+
+		VkBufferCopy region = {};
+		region.srcOffset = src_offset;
+		region.dstOffset = dst_offset;
+		region.size = size;
+		vkCmdCopyBuffer(this->batches[this->current_batch].command_buffer, src_buffer, dst_buffer, 1, &region);
+
+		return true;
+	}
+
+	uint64_t upload_manager::flush()
+	{
+		auto& b = this->batches[this->current_batch];
+
+		if (!b.recording)
+			return this->last_submitted_id;
+
+		vkEndCommandBuffer(b.command_buffer);
+
+		// Ids only grow, so they are the values of the timeline as they are
+		VkSemaphore semaphore = this->timeline_semaphores ? this->timeline.get() : get_semaphore();
+
+		VkTimelineSemaphoreSubmitInfoKHR timeline_info = {};
+		timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timeline_info.signalSemaphoreValueCount = 1;
+		timeline_info.pSignalSemaphoreValues = &b.id;
+
+		VkSubmitInfo submit_info = {};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.pNext = this->timeline_semaphores ? &timeline_info : nullptr;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &b.command_buffer;
+		submit_info.signalSemaphoreCount = 1;
+		submit_info.pSignalSemaphores = &semaphore;
+
+		if (!this->timeline_semaphores)
+			vkResetFences(this->device, 1, &b.fence);
+
+		if (vkQueueSubmit(this->queue, 1, &submit_info, b.fence) != VK_SUCCESS)
+		{
+			std::cout << "Upload batch submit failed" << std::endl;
+			if (!this->timeline_semaphores)
+				this->free_semaphores.push_back(semaphore);
+			b.recording = false;
+			return this->last_submitted_id;
+		}
+
+		if (!this->timeline_semaphores)
+			this->pending_semaphores.push_back(semaphore);
+
+		b.recording = false;
+		b.in_flight = true;
+		this->last_submitted_id = b.id;
+
+		this->current_batch = (this->current_batch + 1) % batch_count;
+
+		return b.id;
+	}
+
+	bool upload_manager::wait(uint64_t batch_id)
+	{
+		// Retire in submission order, the staging ring is freed front to back
+		while (this->last_completed_id < batch_id)
+		{
+			batch* oldest = nullptr;
+			for (auto& b : this->batches)
+			{
+				if (b.in_flight && (oldest == nullptr || b.id < oldest->id))
+					oldest = &b;
+			}
+
+			if (oldest == nullptr)
+				return batch_id <= this->last_submitted_id;
+
+			if (!wait_batch(*oldest))
+				return false;
+
+			retire(*oldest);
+		}
+
+		return true;
+	}
+
+	bool upload_manager::is_complete(uint64_t batch_id)
+	{
+		retire_completed();
+		return this->last_completed_id >= batch_id;
+	}
+
+	bool upload_manager::wait_batch(const batch& b)
+	{
+		if (this->timeline_semaphores)
+			return this->timeline.wait(b.id);
+
+		return vkWaitForFences(this->device, 1, &b.fence, VK_TRUE, std::numeric_limits<uint64_t>::max()) == VK_SUCCESS;
+	}
+
+	bool upload_manager::is_batch_complete(const batch& b)
+	{
+		if (this->timeline_semaphores)
+			return this->timeline.is_complete(b.id);
+
+		return vkGetFenceStatus(this->device, b.fence) == VK_SUCCESS;
+	}
+
+	void upload_manager::retire(batch& b)
+	{
+		this->staging_used -= b.staging_bytes;
+		this->last_completed_id = std::max(this->last_completed_id, b.id);
+
+		b.staging_bytes = 0;
+		b.in_flight = false;
+	}
+
+	void upload_manager::retire_completed()
+	{
+		while (true)
+		{
+			batch* oldest = nullptr;
+			for (auto& b : this->batches)
+			{
+				if (b.in_flight && (oldest == nullptr || b.id < oldest->id))
+					oldest = &b;
+			}
+
+			if (oldest == nullptr || !is_batch_complete(*oldest))
+				return;
+
+			retire(*oldest);
+		}
+	}
+
+	VkSemaphore upload_manager::get_semaphore()
+	{
+		if (!this->free_semaphores.empty())
+		{
+			VkSemaphore semaphore = this->free_semaphores.back();
+			this->free_semaphores.pop_back();
+			return semaphore;
+		}
+
+		VkSemaphoreCreateInfo semaphore_info = {};
+		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		vkCreateSemaphore(this->device, &semaphore_info, nullptr, &semaphore);
+		return semaphore;
+	}
+
+	void upload_manager::take_wait_semaphores(std::vector<VkSemaphore>& semaphores)
+	{
+		semaphores.insert(semaphores.end(), this->pending_semaphores.begin(), this->pending_semaphores.end());
+		this->pending_semaphores.clear();
+	}
+
+	void upload_manager::recycle_semaphores(std::vector<VkSemaphore>& semaphores)
+	{
+		this->free_semaphores.insert(this->free_semaphores.end(), semaphores.begin(), semaphores.end());
+		semaphores.clear();
+	}
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "memory_allocator.h"
+#include "timeline_semaphore.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace renderer
+{
+	// Collects buffer uploads and buffer to buffer copies into one command buffer per batch and submits them
+	// on the transfer queue. Source data goes through a persistently mapped staging ring which is recycled as
+	// soon as the batch that read it has finished. Nothing here ever waits for the queue to go idle.
+	// With timeline semaphores every batch signals its id on one timeline_semaphore, there are no fences or
+	// binary semaphores per batch.
+	struct upload_manager
+	{
+	public:
+		bool initialize(VkDevice device, memory_allocator& allocator, uint32_t queue_family, VkQueue queue, bool timeline_semaphores, VkDeviceSize staging_size = 32ull << 20);
+		void release();
+
+		bool upload(VkBuffer dst_buffer, VkDeviceSize dst_offset, const void* data, VkDeviceSize size);
+		bool copy(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size, VkDeviceSize src_offset = 0, VkDeviceSize dst_offset = 0);
+
+		// Submits everything recorded since the last flush, returns the id of the batch to wait on
+		uint64_t flush();
+		bool wait(uint64_t batch_id);
+		bool is_complete(uint64_t batch_id);
+
+		// Semaphores signaled by submitted batches, the next graphics submit has to wait on them.
+		// Hand them back with recycle_semaphores() once that submit is known to be finished.
+		// Always empty with timeline semaphores, wait for get_last_submitted() on get_timeline() instead.
+		void take_wait_semaphores(std::vector<VkSemaphore>& semaphores);
+		void recycle_semaphores(std::vector<VkSemaphore>& semaphores);
+
+		VkSemaphore get_timeline() const
+		{
+			return timeline.get();
+		}
+
+		uint64_t get_last_submitted() const
+		{
+			return last_submitted_id;
+		}
+
+		uint32_t get_queue_family() const
+		{
+			return queue_family;
+		}
+
+	private:
+		static constexpr uint32_t batch_count = 8;
+
+		struct batch
+		{
+			VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+			VkFence fence = VK_NULL_HANDLE;
+			VkDeviceSize staging_bytes = 0;
+			uint64_t id = 0;
+			bool recording = false;
+			bool in_flight = false;
+		};
+
+		bool begin_batch();
+		bool wait_batch(const batch& b);
+		bool is_batch_complete(const batch& b);
+		bool allocate_staging(VkDeviceSize size, VkDeviceSize& offset);
+		void retire(batch& b);
+		void retire_completed();
+		VkSemaphore get_semaphore();
+
+		VkDevice device = VK_NULL_HANDLE;
+		memory_allocator* allocator = nullptr;
+		uint32_t queue_family = 0;
+		VkQueue queue = VK_NULL_HANDLE;
+		VkCommandPool command_pool = VK_NULL_HANDLE;
+		bool timeline_semaphores = false;
+		timeline_semaphore timeline;
+
+		VkBuffer staging_buffer = VK_NULL_HANDLE;
+		allocation staging_memory;
+		VkDeviceSize staging_size = 0;
+		VkDeviceSize staging_head = 0;
+		VkDeviceSize staging_used = 0;
+
+		batch batches[batch_count];
+		uint32_t current_batch = 0;
+		uint64_t next_batch_id = 1;
+		uint64_t last_submitted_id = 0;
+		uint64_t last_completed_id = 0;
+
+		std::vector<VkSemaphore> pending_semaphores;
+		std::vector<VkSemaphore> free_semaphores;
+	};
+}
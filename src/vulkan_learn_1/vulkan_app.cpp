@@ -1,14 +1,15 @@
 #include "vulkan_app.h"
 
 #include <set>
-#include <fstream>
 #include <algorithm>
+#include <atomic>
 #include <stdio.h>
 
 #define VERTEX_BUFFER_BIND_ID				0 // PER VERTEX
 #define COLOR_BUFFER_BIND_ID				1 // PER INSTANCE
 #define POSITIONS_BUFFER_BIND_ID			2 // PER INSTANCE
 #define SCALE_BUFFER_BIND_ID				3 // PER INSTANCE
+#define PACKED_INSTANCE_BIND_ID				1 // PER INSTANCE, every attribute interleaved (packed layout)
 
 using namespace renderer;
 
@@ -21,8 +22,11 @@ const std::vector<const char*> device_extensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
-static int64_t sum_time = 0;
-static size_t count_frames = 0;
+// Nothing is presented without a window
+const std::vector<const char*> headless_device_extensions = {};
+
+// Frames between two printed profiler reports
+constexpr uint32_t profile_report_interval = 500;
 
 static void resize_callback(GLFWwindow* window, int width, int height)
 {
@@ -30,23 +34,45 @@ static void resize_callback(GLFWwindow* window, int width, int height)
 	app->window_resize();
 }
 
-static std::vector<char> read_file(const std::string& fileName)
+static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-	std::ifstream file(fileName, std::ios::ate | std::ios::binary);
-	std::vector<char> buffer;
+	if (action != GLFW_PRESS && action != GLFW_REPEAT)
+		return;
 
-	if (!file.is_open())
-		return buffer;
+	auto app = reinterpret_cast<VulkanApp*>(glfwGetWindowUserPointer(window));
+	app->key_press(key);
+}
 
-	size_t fileSize = (size_t)file.tellg();
-	buffer.resize(fileSize);
+static vertex_layout get_circle_vertex_layout()
+{
+	return { {
+		{ VERTEX_BUFFER_BIND_ID, sizeof(vertex), VK_VERTEX_INPUT_RATE_VERTEX, {
+			{ 0, VK_FORMAT_R32G32_SFLOAT, offsetof(vertex, pos) } } },
+	} };
+}
 
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
+// Locations match shaders.vert and circle_sdf.vert: 1 position, 2 color, 3 scale
+static vertex_layout get_instance_layout(const instance_layout& layout)
+{
+	// Read from storage buffers by the vertex shaders themselves
+	if (layout == instance_layout::pulled)
+		return {};
 
-	file.close();
+	if (layout == instance_layout::packed)
+	{
+		return { {
+			{ PACKED_INSTANCE_BIND_ID, sizeof(packed_instance), VK_VERTEX_INPUT_RATE_INSTANCE, {
+				{ 1, VK_FORMAT_R16G16_SNORM, offsetof(packed_instance, position) },
+				{ 2, VK_FORMAT_R8G8B8A8_UNORM, offsetof(packed_instance, color) },
+				{ 3, VK_FORMAT_R16_SFLOAT, offsetof(packed_instance, scale) } } },
+		} };
+	}
 
-	return buffer;
+	return { {
+		{ COLOR_BUFFER_BIND_ID, sizeof(glm::vec3), VK_VERTEX_INPUT_RATE_INSTANCE, { { 2, VK_FORMAT_R32G32B32_SFLOAT, 0 } } },
+		{ POSITIONS_BUFFER_BIND_ID, sizeof(glm::vec2), VK_VERTEX_INPUT_RATE_INSTANCE, { { 1, VK_FORMAT_R32G32_SFLOAT, 0 } } },
+		{ SCALE_BUFFER_BIND_ID, sizeof(float), VK_VERTEX_INPUT_RATE_INSTANCE, { { 3, VK_FORMAT_R32_SFLOAT, 0 } } },
+	} };
 }
 
 void VulkanApp::initialize()
@@ -57,13 +83,13 @@ void VulkanApp::initialize()
 
 bool VulkanApp::run()
 {
-	if (!setup_window())
+	if (!this->headless && !setup_window())
 		return false;
 
 	if (!setup_vulkan())
 		return false;
 
-	if (!main_loop())
+	if (!(this->headless ? headless_loop() : main_loop()))
 		return false;
 
 	if (!release())
@@ -80,6 +106,7 @@ bool VulkanApp::setup_window()
 	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 	this->window = glfwCreateWindow(screen_width, screen_height, "Vulkan-Learn-1", nullptr, nullptr);
 	glfwSetFramebufferSizeCallback(this->window, resize_callback);
+	glfwSetKeyCallback(this->window, key_callback);
 	glfwSetWindowPos(this->window, 0, 50);
 	glfwSetWindowUserPointer(this->window, this);
 
@@ -92,12 +119,20 @@ bool VulkanApp::setup_vulkan()
 		return false;
 	if (this->validation_layers_enabled && !set_up_debug_messenger())
 		return false;
-	if (!create_surface())
+	if (!this->headless && !create_surface())
 		return false;
 	if (!pick_physical_device())
 		return false;
 	if (!create_logical_device())
 		return false;
+	if (!this->allocator.initialize(this->physical_device, this->device))
+		return false;
+	if (!this->uploader.initialize(this->device, this->allocator, this->family_indices.transfer_family.value(), this->transfer_queue, this->timeline_semaphores))
+		return false;
+	if (!create_profiler())
+		return false;
+	if (!create_pipeline_cache())
+		return false;
 	if (!create_swap_chain())
 		return false;
 	if (!create_image_views())
@@ -106,31 +141,47 @@ bool VulkanApp::setup_vulkan()
 		return false;
 	if (!set_viewport_scissor())
 		return false;
-	if (!create_descriptor_set_layout())
+	if (!create_instance_descriptor_set_layout())
 		return false;
+
+	// The compute descriptor set layout in between is negligible next to the shader compiles
+	const auto t_pipelines = std::chrono::high_resolution_clock::now();
+
 	if (!create_graphics_pipeline())
 		return false;
+	if (!create_compute_descriptor_set_layout())
+		return false;
+	if (!create_compute_pipeline())
+		return false;
+
+	this->pipeline_cache.report_creation_time(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t_pipelines).count());
+
 	if (!create_frame_buffers())
 		return false;
 	if (!create_command_pool())
 		return false;
+	if (!create_sync_objects())
+		return false;
 	if (!create_vertex_buffer())
 		return false;
 	if (!create_index_buffer())
 		return false;
 	if (!create_instance_buffers())
 		return false;
-	if (!create_uniform_buffers())
+	if (!create_compute_descriptor_pool())
 		return false;
-	if (!create_descriptor_pool())
+	if (!create_compute_descriptor_sets())
 		return false;
-	if (!create_descriptor_sets())
+	if (!create_instance_descriptor_sets())
 		return false;
 	if (!create_command_buffers())
 		return false;
-	if (!create_sync_objects())
+	if (!create_compute_command_buffers())
 		return false;
 
+	// Static geometry and the initial instance data go out in one batch, the first frame waits for it
+	this->uploader.flush();
+
 	return true;
 }
 
@@ -201,13 +252,24 @@ bool VulkanApp::create_instance()
 	uint32_t glfw_extensions_count = 0;
 	const char** glfw_extensions;
 
-	glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extensions_count);
+	// GLFW isn't initialized in headless mode and no surface extension is needed
+	glfw_extensions = this->headless ? nullptr : glfwGetRequiredInstanceExtensions(&glfw_extensions_count);
 
 	std::vector<const char*> required_extentions(glfw_extensions, glfw_extensions + glfw_extensions_count);
 
 	if (validation_layers_enabled)
 		required_extentions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
+	// Optional, the timeline semaphore feature can't be queried without it
+	for (const auto& extension : available_extensions)
+	{
+		if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+			this->physical_device_properties2 = true;
+	}
+
+	if (this->physical_device_properties2)
+		required_extentions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
 	// check if extentions required is available
 	if (glfw_extensions_count > available_extention_count)
 	{
@@ -342,7 +404,8 @@ bool VulkanApp::check_device_extensions_support()
 	std::vector<VkExtensionProperties> available_extensions(available_extensions_count);
 	vkEnumerateDeviceExtensionProperties(this->physical_device, nullptr, &available_extensions_count, available_extensions.data());
 
-	std::set<std::string> required_extensions(device_extensions.begin(), device_extensions.end());
+	const auto& extensions = this->headless ? headless_device_extensions : device_extensions;
+	std::set<std::string> required_extensions(extensions.begin(), extensions.end());
 
 	for (auto& extension : available_extensions)
 		required_extensions.erase(extension.extensionName);
@@ -350,13 +413,52 @@ bool VulkanApp::check_device_extensions_support()
 	return required_extensions.empty();
 }
 
+bool VulkanApp::supports_timeline_semaphores()
+{
+	if (!this->physical_device_properties2)
+		return false;
+
+	uint32_t available_extensions_count;
+	vkEnumerateDeviceExtensionProperties(this->physical_device, nullptr, &available_extensions_count, nullptr);
+	std::vector<VkExtensionProperties> available_extensions(available_extensions_count);
+	vkEnumerateDeviceExtensionProperties(this->physical_device, nullptr, &available_extensions_count, available_extensions.data());
+
+	bool found_extension = false;
+	for (const auto& extension : available_extensions)
+	{
+		if (strcmp(extension.extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0)
+			found_extension = true;
+	}
+
+	auto GetPhysicalDeviceFeatures2KHR = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(this->instance, "vkGetPhysicalDeviceFeatures2KHR");
+
+	if (!found_extension || GetPhysicalDeviceFeatures2KHR == nullptr)
+		return false;
+
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {};
+	timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+	VkPhysicalDeviceFeatures2KHR features = {};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+	features.pNext = &timeline_features;
+	GetPhysicalDeviceFeatures2KHR(this->physical_device, &features);
+
+	return timeline_features.timelineSemaphore == VK_TRUE;
+}
+
 bool VulkanApp::create_logical_device()
 {
 	if (!check_device_extensions_support())
 		return false;
 
 	this->family_indices = helper::find_queue_family_indices(this->physical_device, this->surface);
-	std::set<uint32_t> unique_queue_families = { family_indices.graphics_family.value(), family_indices.present_family.value() };
+	std::set<uint32_t> unique_queue_families = {
+		family_indices.graphics_family.value(),
+		family_indices.transfer_family.value(),
+		family_indices.compute_family.value() };
+
+	if (family_indices.present_family.has_value())
+		unique_queue_families.insert(family_indices.present_family.value());
 
 	std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
 
@@ -372,16 +474,38 @@ bool VulkanApp::create_logical_device()
 		queue_create_infos.push_back(queue_create_info);
 	}
 
-	// nothing for now
+	VkPhysicalDeviceFeatures supported_features = {};
+	vkGetPhysicalDeviceFeatures(this->physical_device, &supported_features);
+
 	VkPhysicalDeviceFeatures device_features = {};
+	device_features.drawIndirectFirstInstance = supported_features.drawIndirectFirstInstance;
+
+	this->lod_buckets_enabled = supported_features.drawIndirectFirstInstance == VK_TRUE;
+	if (!this->lod_buckets_enabled)
+		log("drawIndirectFirstInstance not supported, circles use a single level of detail");
+
+	std::vector<const char*> extensions = this->headless ? headless_device_extensions : device_extensions;
+
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {};
+	timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+	if (this->timeline_semaphores_enabled && supports_timeline_semaphores())
+	{
+		extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+		timeline_features.timelineSemaphore = VK_TRUE;
+		this->timeline_semaphores = true;
+	}
+
+	log("Frames and uploads synchronized with " << (this->timeline_semaphores ? "timeline semaphores" : "fences"));
 
 	VkDeviceCreateInfo  create_info = {};
 	create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	create_info.pNext = this->timeline_semaphores ? &timeline_features : nullptr;
 	create_info.queueCreateInfoCount = static_cast<uint32_t>(queue_create_infos.size());
 	create_info.pQueueCreateInfos = queue_create_infos.data();
 	create_info.pEnabledFeatures = &device_features;
-	create_info.enabledExtensionCount = static_cast<uint32_t>(device_extensions.size());
-	create_info.ppEnabledExtensionNames = device_extensions.data();
+	create_info.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+	create_info.ppEnabledExtensionNames = extensions.data();
 
 	if (validation_layers_enabled)
 	{
@@ -396,7 +520,16 @@ bool VulkanApp::create_logical_device()
 	auto result = vkCreateDevice(this->physical_device, &create_info, nullptr, &this->device);
 
 	vkGetDeviceQueue(device, family_indices.graphics_family.value(), 0, &graphics_queue);
-	vkGetDeviceQueue(device, family_indices.present_family.value(), 0, &present_queue);
+	if (family_indices.present_family.has_value())
+		vkGetDeviceQueue(device, family_indices.present_family.value(), 0, &present_queue);
+	vkGetDeviceQueue(device, family_indices.transfer_family.value(), 0, &transfer_queue);
+	vkGetDeviceQueue(device, family_indices.compute_family.value(), 0, &compute_queue);
+
+	const std::set<uint32_t> upload_families = {
+		family_indices.graphics_family.value(),
+		family_indices.transfer_family.value(),
+		family_indices.compute_family.value() };
+	this->upload_queue_families.assign(upload_families.begin(), upload_families.end());
 
 	return result == VK_SUCCESS;
 }
@@ -406,8 +539,56 @@ bool VulkanApp::create_surface()
 	return glfwCreateWindowSurface(this->instance, this->window, nullptr, &this->surface) == VK_SUCCESS;
 }
 
+bool VulkanApp::create_pipeline_cache()
+{
+	// Next to the executable
+	const std::string file_name = files::get_app_directory() + "pipeline_cache.bin";
+
+	if (!this->pipeline_cache.initialize(this->physical_device, this->device, file_name))
+	{
+		log("Couldn't Create Pipeline Cache");
+		return false;
+	}
+
+	return true;
+}
+
+bool VulkanApp::create_profiler()
+{
+	// The history holds every measured frame when there is a limit
+	const uint32_t history_size = std::max(this->measured_frames, 512u);
+
+	if (!this->profiler.initialize(this->physical_device, this->device, this->family_indices.graphics_family.value(), this->graphics_queue, this->frames_in_flight, history_size))
+	{
+		log("Couldn't Initialize Profiler");
+		return false;
+	}
+
+	// Without timestamps on the compute family the graphics command buffer resets the queries instead
+	this->compute_timestamps = this->profiler.supports_timestamps(this->family_indices.compute_family.value());
+
+	auto& scopes = this->profile_scopes;
+	scopes.frame = this->profiler.add_scope("frame", false);
+	scopes.wait = this->profiler.add_scope(this->timeline_semaphores ? "vkWaitSemaphoresKHR" : "vkWaitForFences", false);
+	scopes.acquire = this->profiler.add_scope("vkAcquireNextImageKHR", false);
+	scopes.update = this->profiler.add_scope("update", false);
+	scopes.physics = this->profiler.add_scope("physics", false);
+	scopes.record = this->profiler.add_scope("record", false);
+	scopes.submit = this->profiler.add_scope("vkQueueSubmit", false);
+	scopes.present = this->profiler.add_scope("vkQueuePresentKHR", false);
+	scopes.simulate = this->profiler.add_scope("simulate", true, "compute queue");
+	scopes.cull = this->profiler.add_scope("cull", true, "compute queue");
+	scopes.render_pass = this->profiler.add_scope("render pass", true, "graphics queue");
+	scopes.gpu_frame = this->profiler.add_gpu_frame_scope("gpu frame");
+
+	return true;
+}
+
 bool VulkanApp::create_swap_chain()
 {
+	if (this->headless)
+		return create_offscreen_images();
+
 	// Get Properties
 
 	SwapChainSupportDetails properties;
@@ -526,7 +707,8 @@ bool VulkanApp::create_swap_chain()
 	create_info.preTransform = properties.capabilities.currentTransform;
 	create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	create_info.clipped = VK_TRUE;
-	create_info.oldSwapchain = VK_NULL_HANDLE;
+	// Hands over the images the old swap chain still has queued, the old one is retired by recreate_swap_chain()
+	create_info.oldSwapchain = this->swap_chain;
 	create_info.surface = this->surface;
 
 	if (vkCreateSwapchainKHR(this->device, &create_info, nullptr, &this->swap_chain) != VK_SUCCESS)
@@ -537,6 +719,41 @@ bool VulkanApp::create_swap_chain()
 	this->swap_chain_images.resize(images_count);
 	vkGetSwapchainImagesKHR(this->device, this->swap_chain, &images_count, this->swap_chain_images.data());
 
+	// The old images are gone, nothing is rendering to the new ones yet
+	this->images_in_flight.assign(images_count, 0);
+
+	return true;
+}
+
+bool VulkanApp::create_offscreen_images()
+{
+	this->swap_chain_extent = { static_cast<uint32_t>(screen_width), static_cast<uint32_t>(screen_height) };
+	this->swap_chain_image_format = VK_FORMAT_B8G8R8A8_UNORM;
+
+	this->offscreen_images.resize(offscreen_image_count);
+	this->swap_chain_images.resize(offscreen_image_count);
+
+	for (uint32_t i = 0; i < offscreen_image_count; ++i)
+	{
+		// Transfer source so a frame can be read back for inspection
+		if (!helper::create_image(
+			this->device,
+			this->allocator,
+			this->swap_chain_extent,
+			this->swap_chain_image_format,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			this->offscreen_images[i]))
+		{
+			log("Couldn't Create Offscreen Image, " << i);
+			return false;
+		}
+
+		this->swap_chain_images[i] = this->offscreen_images[i].image;
+	}
+
+	this->images_in_flight.assign(offscreen_image_count, 0);
+	this->next_offscreen_image = 0;
+
 	return true;
 }
 
@@ -585,7 +802,7 @@ bool VulkanApp::create_renderpass()
 	color_attachement.format = this->swap_chain_image_format;
 	color_attachement.samples = VK_SAMPLE_COUNT_1_BIT;
 	color_attachement.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	color_attachement.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	color_attachement.finalLayout = this->headless ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 	color_attachement.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	color_attachement.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	color_attachement.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
@@ -618,48 +835,62 @@ bool VulkanApp::create_renderpass()
 	return true;
 }
 
-bool VulkanApp::create_descriptor_set_layout()
+bool VulkanApp::create_instance_descriptor_set_layout()
 {
-	VkDescriptorSetLayoutBinding descriptor_set_binding = {};
-	descriptor_set_binding.binding = 0;
-	descriptor_set_binding.descriptorCount = 1;
-	descriptor_set_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptor_set_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	if (this->instance_stream_layout != instance_layout::pulled)
+		return true;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings =
+	{
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0), // visible ids slice
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 1), // positions slice
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 2), // colors
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 3), // scales
+	};
 
 	VkDescriptorSetLayoutCreateInfo layout_info = {};
 	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layout_info.bindingCount = 1;
-	layout_info.pBindings = &descriptor_set_binding;
-	//descriptor_set_info.flags = 
-
-	if (vkCreateDescriptorSetLayout(this->device, &layout_info, nullptr, &this->ubo_descriptor_set_layout) != VK_SUCCESS)
-		return false;
+	layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
+	layout_info.pBindings = bindings.data();
 
-	return true;
+	return vkCreateDescriptorSetLayout(this->device, &layout_info, nullptr, &this->instance_descriptor_set_layout) == VK_SUCCESS;
 }
 
 bool VulkanApp::create_graphics_pipeline()
 {
-	std::string path = files::get_app_path();
+	// The pulled layout has builds of the vertex shaders without instance attributes
+	const bool pulled = this->instance_stream_layout == instance_layout::pulled;
 
-	auto vert_shader = read_file(path + "\\..\\..\\..\\..\\..\\src\\shaders\\shaders.vert.spv");
-	auto frag_shader = read_file(path + "\\..\\..\\..\\..\\..\\src\\shaders\\shaders.frag.spv");
+	VkShaderModule vert_shader_module = this->shaders.create_module(this->device, pulled ? shader_id::mesh_pulled_vert : shader_id::mesh_vert);
+	VkShaderModule frag_shader_module = this->shaders.create_module(this->device, shader_id::mesh_frag);
+	VkShaderModule sdf_vert_shader_module = this->shaders.create_module(this->device, pulled ? shader_id::sdf_pulled_vert : shader_id::sdf_vert);
+	VkShaderModule sdf_frag_shader_module = this->shaders.create_module(this->device, shader_id::sdf_frag);
 
-	if (vert_shader.empty() || frag_shader.empty())
+	if (vert_shader_module == VK_NULL_HANDLE || frag_shader_module == VK_NULL_HANDLE || sdf_vert_shader_module == VK_NULL_HANDLE || sdf_frag_shader_module == VK_NULL_HANDLE)
 	{
-		log("Make sure shaders are correctly read from file.");
+		vkDestroyShaderModule(this->device, vert_shader_module, nullptr);
+		vkDestroyShaderModule(this->device, frag_shader_module, nullptr);
+		vkDestroyShaderModule(this->device, sdf_vert_shader_module, nullptr);
+		vkDestroyShaderModule(this->device, sdf_frag_shader_module, nullptr);
 		return false;
 	}
 
-	VkShaderModule vert_shader_module = helper::create_shader_module(this->device, vert_shader);
-	VkShaderModule frag_shader_module = helper::create_shader_module(this->device, frag_shader);
-
 	// Shaders
+	const VkBool32 packed_instances = this->instance_stream_layout == instance_layout::packed ? VK_TRUE : VK_FALSE;
+	const VkSpecializationMapEntry packed_entry = { 0, 0, sizeof(VkBool32) };
+
+	VkSpecializationInfo vert_specialization_info = {};
+	vert_specialization_info.mapEntryCount = 1;
+	vert_specialization_info.pMapEntries = &packed_entry;
+	vert_specialization_info.dataSize = sizeof(VkBool32);
+	vert_specialization_info.pData = &packed_instances;
+
 	VkPipelineShaderStageCreateInfo vert_shader_stage_info = {};
 	vert_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
 	vert_shader_stage_info.module = vert_shader_module;
 	vert_shader_stage_info.pName = "main";
+	vert_shader_stage_info.pSpecializationInfo = &vert_specialization_info;
 
 	VkPipelineShaderStageCreateInfo frag_shader_stage_info = {};
 	frag_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -669,21 +900,17 @@ bool VulkanApp::create_graphics_pipeline()
 
 	VkPipelineShaderStageCreateInfo shader_stages[] = { vert_shader_stage_info, frag_shader_stage_info };
 
-	std::vector<VkVertexInputBindingDescription> bindings =
-	{
-		initializers::vertex_input_binding_description(VERTEX_BUFFER_BIND_ID, sizeof(vertex), VK_VERTEX_INPUT_RATE_VERTEX),
-		initializers::vertex_input_binding_description(COLOR_BUFFER_BIND_ID, sizeof(glm::vec3), VK_VERTEX_INPUT_RATE_INSTANCE),
-		initializers::vertex_input_binding_description(POSITIONS_BUFFER_BIND_ID, sizeof(glm::vec2), VK_VERTEX_INPUT_RATE_INSTANCE),
-		initializers::vertex_input_binding_description(SCALE_BUFFER_BIND_ID, sizeof(float), VK_VERTEX_INPUT_RATE_INSTANCE),
-	};
+	// Mesh pipeline reads the circle vertices plus the instance streams, the SDF one only the instance streams
+	const vertex_layout instance_streams = get_instance_layout(this->instance_stream_layout);
 
-	std::vector<VkVertexInputAttributeDescription> attributes =
-	{
-		initializers::vertex_input_attribute_description(VERTEX_BUFFER_BIND_ID,		0, VK_FORMAT_R32G32_SFLOAT, offsetof(vertex, pos)),
-		initializers::vertex_input_attribute_description(POSITIONS_BUFFER_BIND_ID,	1, VK_FORMAT_R32G32_SFLOAT, 0),
-		initializers::vertex_input_attribute_description(COLOR_BUFFER_BIND_ID,		2, VK_FORMAT_R32G32B32_SFLOAT, 0),
-		initializers::vertex_input_attribute_description(SCALE_BUFFER_BIND_ID,		3, VK_FORMAT_R32_SFLOAT, 0),
-	};
+	std::vector<VkVertexInputBindingDescription> bindings;
+	std::vector<VkVertexInputAttributeDescription> attributes;
+	get_circle_vertex_layout().append_to(bindings, attributes);
+	instance_streams.append_to(bindings, attributes);
+
+	std::vector<VkVertexInputBindingDescription> sdf_bindings;
+	std::vector<VkVertexInputAttributeDescription> sdf_attributes;
+	instance_streams.append_to(sdf_bindings, sdf_attributes);
 
 	// VI
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
@@ -746,10 +973,16 @@ bool VulkanApp::create_graphics_pipeline()
 	// Pipeline Layout : Q : Why layout should be created and what is it's usage?
 	VkPipelineLayoutCreateInfo pipeline_layout_info = {};
 	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipeline_layout_info.setLayoutCount = 1;
-	pipeline_layout_info.pSetLayouts = &this->ubo_descriptor_set_layout;
-	pipeline_layout_info.pushConstantRangeCount = 0;
-	pipeline_layout_info.pPushConstantRanges = nullptr;
+	// The camera travels as push constants, only the pulled layout has a descriptor set
+	VkPushConstantRange camera_range = {};
+	camera_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	camera_range.offset = 0;
+	camera_range.size = sizeof(camera_constants);
+
+	pipeline_layout_info.setLayoutCount = pulled ? 1 : 0;
+	pipeline_layout_info.pSetLayouts = pulled ? &this->instance_descriptor_set_layout : nullptr;
+	pipeline_layout_info.pushConstantRangeCount = 1;
+	pipeline_layout_info.pPushConstantRanges = &camera_range;
 
 	if (vkCreatePipelineLayout(this->device, &pipeline_layout_info, nullptr, &this->pipeline_layout) != VK_SUCCESS)
 	{
@@ -757,6 +990,8 @@ bool VulkanApp::create_graphics_pipeline()
 
 		vkDestroyShaderModule(this->device, vert_shader_module, nullptr);
 		vkDestroyShaderModule(this->device, frag_shader_module, nullptr);
+		vkDestroyShaderModule(this->device, sdf_vert_shader_module, nullptr);
+		vkDestroyShaderModule(this->device, sdf_frag_shader_module, nullptr);
 
 		return false;
 	}
@@ -790,7 +1025,7 @@ bool VulkanApp::create_graphics_pipeline()
 
 	if (vkCreateGraphicsPipelines(
 		this->device,
-		VK_NULL_HANDLE,
+		this->pipeline_cache.get(),
 		1,
 		&pipeline_create_info,
 		nullptr,
@@ -801,108 +1036,227 @@ bool VulkanApp::create_graphics_pipeline()
 		free(shader_stages);
 		vkDestroyShaderModule(this->device, vert_shader_module, nullptr);
 		vkDestroyShaderModule(this->device, frag_shader_module, nullptr);
+		vkDestroyShaderModule(this->device, sdf_vert_shader_module, nullptr);
+		vkDestroyShaderModule(this->device, sdf_frag_shader_module, nullptr);
 
 		return false;
 	}
 
+	// SDF variant: same instance streams without the per-vertex one, quads are not culled and blend their antialiased edge
+	shader_stages[0].module = sdf_vert_shader_module;
+	shader_stages[1].module = sdf_frag_shader_module;
+
+	vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(sdf_bindings.size());
+	vertexInputInfo.pVertexBindingDescriptions = sdf_bindings.data();
+	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(sdf_attributes.size());
+	vertexInputInfo.pVertexAttributeDescriptions = sdf_attributes.data();
+
+	rasterizer.cullMode = VK_CULL_MODE_NONE;
+
+	colorBlendAttachment.blendEnable = VK_TRUE;
+	colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+	colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+	const auto sdf_result = vkCreateGraphicsPipelines(this->device, this->pipeline_cache.get(), 1, &pipeline_create_info, nullptr, &this->sdf_pipeline);
+
 	vkDestroyShaderModule(this->device, vert_shader_module, nullptr);
 	vkDestroyShaderModule(this->device, frag_shader_module, nullptr);
+	vkDestroyShaderModule(this->device, sdf_vert_shader_module, nullptr);
+	vkDestroyShaderModule(this->device, sdf_frag_shader_module, nullptr);
+
+	if (sdf_result != VK_SUCCESS)
+	{
+		log("Create SDF Pipeline Failed.");
+		return false;
+	}
 
 	return true;
 }
 
-bool VulkanApp::create_vertex_buffer()
+bool VulkanApp::create_compute_descriptor_set_layout()
 {
-	get_circle_model(30, &this->circle_model);
-	const VkDeviceSize buffer_size = sizeof(vertex) * this->circle_model.vertices.size();
+	std::vector<VkDescriptorSetLayoutBinding> bindings =
+	{
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0), // state
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1), // scales
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2), // positions slice
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3), // params slice
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4), // colors
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 5), // cull groups
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 6), // draw command slice
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 7), // visible positions slice
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 8), // visible colors slice
+		initializers::descriptor_set_layout_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 9), // visible scales slice
+	};
 
-	VkBuffer staging_buffer;
-	VkDeviceMemory staging_buffer_memory;
+	VkDescriptorSetLayoutCreateInfo layout_info = {};
+	layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
+	layout_info.pBindings = bindings.data();
 
-	if (!helper::create_buffer(
-		this->device,
-		this->physical_device,
-		buffer_size,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		staging_buffer,
-		staging_buffer_memory))
+	return vkCreateDescriptorSetLayout(this->device, &layout_info, nullptr, &this->compute_descriptor_set_layout) == VK_SUCCESS;
+}
+
+bool VulkanApp::create_compute_pipeline()
+{
+	VkShaderModule comp_shader_module = this->shaders.create_module(this->device, shader_id::simulate_comp);
+	VkShaderModule cull_shader_module = this->shaders.create_module(this->device, shader_id::cull_comp);
+
+	if (comp_shader_module == VK_NULL_HANDLE || cull_shader_module == VK_NULL_HANDLE)
 	{
+		vkDestroyShaderModule(this->device, comp_shader_module, nullptr);
+		vkDestroyShaderModule(this->device, cull_shader_module, nullptr);
 		return false;
 	}
 
-	void* data;
-	vkMapMemory(this->device, staging_buffer_memory, 0, buffer_size, 0, &data);
-	memcpy(data, this->circle_model.vertices.data(), (size_t)buffer_size);
-	vkUnmapMemory(this->device, staging_buffer_memory);
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount = 1;
+	pipeline_layout_info.pSetLayouts = &this->compute_descriptor_set_layout;
 
-	if (!helper::create_buffer(
-		this->device,
-		this->physical_device,
-		buffer_size,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		this->vertex_buffer,
-		this->vertex_buffer_memory))
+	if (vkCreatePipelineLayout(this->device, &pipeline_layout_info, nullptr, &this->compute_pipeline_layout) != VK_SUCCESS)
 	{
+		log("Create Compute Pipeline Layout Failed.");
+		vkDestroyShaderModule(this->device, comp_shader_module, nullptr);
+		vkDestroyShaderModule(this->device, cull_shader_module, nullptr);
 		return false;
 	}
 
-	helper::copy_buffer(this->device, this->command_pool, this->graphics_queue, staging_buffer, this->vertex_buffer, buffer_size);
+	VkComputePipelineCreateInfo pipeline_create_info = {};
+	pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_create_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline_create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline_create_info.stage.module = comp_shader_module;
+	pipeline_create_info.stage.pName = "main";
+	pipeline_create_info.layout = this->compute_pipeline_layout;
+	pipeline_create_info.basePipelineIndex = -1;
+
+	auto result = vkCreateComputePipelines(this->device, this->pipeline_cache.get(), 1, &pipeline_create_info, nullptr, &this->compute_pipeline);
+
+	// One pipeline per cull pass, selected through the CULL_PASS specialization constant. OUTPUT_LAYOUT follows the instance layout.
+	struct
+	{
+		uint32_t pass;
+		uint32_t output_layout;
+	} cull_constants = { 0, static_cast<uint32_t>(this->instance_stream_layout) };
+
+	const VkSpecializationMapEntry cull_entries[] =
+	{
+		{ 0, offsetof(decltype(cull_constants), pass), sizeof(uint32_t) },
+		{ 1, offsetof(decltype(cull_constants), output_layout), sizeof(uint32_t) },
+	};
+
+	for (uint32_t pass = 0; pass < 3 && result == VK_SUCCESS; ++pass)
+	{
+		cull_constants.pass = pass;
+
+		VkSpecializationInfo specialization_info = {};
+		specialization_info.mapEntryCount = 2;
+		specialization_info.pMapEntries = cull_entries;
+		specialization_info.dataSize = sizeof(cull_constants);
+		specialization_info.pData = &cull_constants;
+
+		pipeline_create_info.stage.module = cull_shader_module;
+		pipeline_create_info.stage.pSpecializationInfo = &specialization_info;
+
+		result = vkCreateComputePipelines(this->device, this->pipeline_cache.get(), 1, &pipeline_create_info, nullptr, &this->cull_pipelines[pass]);
+	}
+
+	vkDestroyShaderModule(this->device, comp_shader_module, nullptr);
+	vkDestroyShaderModule(this->device, cull_shader_module, nullptr);
 
-	vkDestroyBuffer(this->device, staging_buffer, nullptr);
-	vkFreeMemory(this->device, staging_buffer_memory, nullptr);
+	if (result != VK_SUCCESS)
+	{
+		log("Create Compute Pipeline Failed.");
+		return false;
+	}
 
 	return true;
 }
 
-bool VulkanApp::create_index_buffer()
+bool VulkanApp::create_vertex_buffer()
 {
-	const VkDeviceSize buffer_size = sizeof(uint16_t) * this->circle_model.indices.size();
+	if (this->circle_segments > 0)
+		get_circle_lods({ this->circle_segments }, &this->circle_model, &this->circle_lods);
+	else
+		get_circle_lods({ 6, 12, 24, 48, 96, 256 }, &this->circle_model, &this->circle_lods);
 
-	VkBuffer staging_buffer;
-	VkDeviceMemory staging_buffer_memory;
+	const VkDeviceSize buffer_size = sizeof(vertex) * this->circle_model.vertices.size();
 
 	if (!helper::create_buffer(
 		this->device,
-		this->physical_device,
+		this->allocator,
 		buffer_size,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		staging_buffer,
-		staging_buffer_memory))
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		this->vertex_buffer,
+		this->upload_queue_families))
 	{
 		return false;
 	}
 
-	void* data;
-	vkMapMemory(this->device, staging_buffer_memory, 0, buffer_size, 0, &data);
-	memcpy(data, this->circle_model.indices.data(), (size_t)buffer_size);
-	vkUnmapMemory(this->device, staging_buffer_memory);
+	return this->uploader.upload(this->vertex_buffer.buffer, 0, this->circle_model.vertices.data(), buffer_size);
+}
+
+bool VulkanApp::create_index_buffer()
+{
+	// Two triangles over the corners picked from gl_VertexIndex in circle_sdf.vert
+	const uint16_t quad_indices[] = { 0, 1, 2, 2, 1, 3 };
+
+	this->quad_lod.first_index = static_cast<uint32_t>(this->circle_model.indices.size());
+	this->quad_lod.index_count = 6;
+	this->quad_lod.max_radius = std::numeric_limits<float>::max();
+
+	const VkDeviceSize quad_indices_offset = sizeof(uint16_t) * this->circle_model.indices.size();
+	const VkDeviceSize buffer_size = quad_indices_offset + sizeof(quad_indices);
 
 	if (!helper::create_buffer(
 		this->device,
-		this->physical_device,
+		this->allocator,
 		buffer_size,
 		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		this->index_buffer,
-		this->index_buffer_memory))
+		this->upload_queue_families))
 	{
 		return false;
 	}
 
-	helper::copy_buffer(this->device, this->command_pool, this->graphics_queue, staging_buffer, this->index_buffer, buffer_size);
-
-	vkDestroyBuffer(this->device, staging_buffer, nullptr);
-	vkFreeMemory(this->device, staging_buffer_memory, nullptr);
-
-	return true;
+	return this->uploader.upload(this->index_buffer.buffer, 0, this->circle_model.indices.data(), quad_indices_offset)
+		&& this->uploader.upload(this->index_buffer.buffer, quad_indices_offset, quad_indices, sizeof(quad_indices));
 }
 
 bool VulkanApp::create_instance_buffers()
 {
-	setup_circles();
+	this->instance_count = this->requested_instance_count;
+	this->instance_capacity = this->instance_count;
+
+	setup_circles(0, this->instance_count);
+
+	if (this->cpu_physics || this->parallel_recording)
+		this->jobs.initialize(this->worker_threads);
+
+	// Job types are registered before the simulation thread starts running jobs
+	if (this->parallel_recording)
+		this->record_job = this->jobs.add_job_type("record draws");
+
+	if (this->cpu_physics)
+	{
+		this->physics.set_job_system(&this->jobs);
+
+		log("CPU physics (" << circle_physics::get_instruction_set() << ", " << this->jobs.get_thread_count() << " threads"
+			<< (this->threaded_simulation ? ", own thread" : "") << ")");
+
+		if (this->threaded_simulation)
+		{
+			this->physics.extent = glm::vec2(static_cast<float>(this->swap_chain_extent.width), static_cast<float>(this->swap_chain_extent.height));
+			this->simulation.start(&this->physics, &this->jobs);
+		}
+	}
 
 	if (!create_colors_buffer())
 		return false;
@@ -910,88 +1264,183 @@ bool VulkanApp::create_instance_buffers()
 		return false;
 	if (!create_scales_buffer())
 		return false;
+	if (!create_simulation_buffers())
+		return false;
+	if (!create_visible_buffers())
+		return false;
 
-	return true;
+	return upload_instance_data(0, this->instance_count);
 }
 
-bool VulkanApp::create_uniform_buffers()
+bool VulkanApp::create_compute_descriptor_pool()
 {
-	const auto buffer_size = sizeof(UniformBufferObject);
+	const auto frames = this->frames_in_flight;
+
+	VkDescriptorPoolSize pool_sizes[2] = {};
+	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	pool_sizes[0].descriptorCount = 9 * frames;
+	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	pool_sizes[1].descriptorCount = frames;
+
+	VkDescriptorPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.poolSizeCount = 2;
+	pool_info.pPoolSizes = pool_sizes;
+	pool_info.maxSets = frames;
 
-	const auto size = this->swap_chain_images.size();
-	this->ubo_buffers.resize(size);
-	this->ubo_buffers_memory.resize(size);
+	return vkCreateDescriptorPool(this->device, &pool_info, nullptr, &this->compute_descriptor_pool) == VK_SUCCESS;
+}
+
+bool VulkanApp::create_compute_descriptor_sets()
+{
+	VkDescriptorSetAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.pSetLayouts = &this->compute_descriptor_set_layout;
+	alloc_info.descriptorPool = this->compute_descriptor_pool;
+	alloc_info.descriptorSetCount = 1;
 
-	for (size_t i = 0; i < size; ++i)
+	for (auto& frame : this->frames)
 	{
-		if (!helper::create_buffer(
-			this->device,
-			this->physical_device,
-			buffer_size,
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			this->ubo_buffers[i],
-			this->ubo_buffers_memory[i]))
-		{
+		if (vkAllocateDescriptorSets(this->device, &alloc_info, &frame.compute_descriptor_set) != VK_SUCCESS)
 			return false;
-		}
 	}
 
+	update_compute_descriptor_sets();
+
 	return true;
 }
 
-bool VulkanApp::create_descriptor_pool()
+void VulkanApp::update_compute_descriptor_sets()
+{
+	for (uint32_t i = 0; i < this->frames_in_flight; ++i)
+	{
+		const VkDescriptorSet set = this->frames[i].compute_descriptor_set;
+
+		VkDescriptorBufferInfo state_info = this->simulation_buffer.get_descriptor_info();
+		VkDescriptorBufferInfo scales_info = this->scales_buffer.get_descriptor_info();
+
+		VkDescriptorBufferInfo positions_info = {};
+		positions_info.buffer = this->positions_ring.data.buffer;
+		positions_info.offset = this->positions_ring.get_offset(i);
+		positions_info.range = this->positions_ring.slice_size;
+
+		VkDescriptorBufferInfo params_info = {};
+		params_info.buffer = this->frame_params_ring.data.buffer;
+		params_info.offset = this->frame_params_ring.get_offset(i);
+		params_info.range = sizeof(FrameParams);
+
+		VkDescriptorBufferInfo colors_info = this->colors_buffer.get_descriptor_info();
+		VkDescriptorBufferInfo groups_info = this->cull_groups_buffer.get_descriptor_info();
+
+		const VkDeviceSize visible_offset = this->visible_ring.get_offset(i);
+
+		VkDescriptorBufferInfo draw_info = {};
+		draw_info.buffer = this->visible_ring.data.buffer;
+		draw_info.offset = visible_offset;
+		draw_info.range = sizeof(VkDrawIndexedIndirectCommand) * max_circle_lods;
+
+		VkDescriptorBufferInfo visible_positions_info = {};
+		visible_positions_info.buffer = this->visible_ring.data.buffer;
+		visible_positions_info.offset = visible_offset + this->visible_positions_offset;
+		visible_positions_info.range = this->visible_colors_offset - this->visible_positions_offset;
+
+		VkDescriptorBufferInfo visible_colors_info = {};
+		visible_colors_info.buffer = this->visible_ring.data.buffer;
+		visible_colors_info.offset = visible_offset + this->visible_colors_offset;
+		visible_colors_info.range = this->visible_scales_offset - this->visible_colors_offset;
+
+		VkDescriptorBufferInfo visible_scales_info = {};
+		visible_scales_info.buffer = this->visible_ring.data.buffer;
+		visible_scales_info.offset = visible_offset + this->visible_scales_offset;
+		visible_scales_info.range = this->visible_ring.slice_size - this->visible_scales_offset;
+
+		std::vector<VkWriteDescriptorSet> writes =
+		{
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &state_info),
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &scales_info),
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &positions_info),
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &params_info),
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4, &colors_info),
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5, &groups_info),
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6, &draw_info),
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7, &visible_positions_info),
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8, &visible_colors_info),
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 9, &visible_scales_info),
+		};
+
+		vkUpdateDescriptorSets(this->device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+	}
+}
+
+bool VulkanApp::create_instance_descriptor_sets()
 {
+	if (this->instance_stream_layout != instance_layout::pulled)
+		return true;
+
+	const auto frames = this->frames_in_flight;
+
 	VkDescriptorPoolSize pool_size = {};
-	pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	pool_size.descriptorCount = static_cast<uint32_t>(this->swap_chain_images.size());
+	pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	pool_size.descriptorCount = 4 * frames;
 
 	VkDescriptorPoolCreateInfo pool_info = {};
 	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	pool_info.poolSizeCount = 1;
 	pool_info.pPoolSizes = &pool_size;
-	pool_info.maxSets = static_cast<uint32_t>(this->swap_chain_images.size());
+	pool_info.maxSets = frames;
 
-	if (vkCreateDescriptorPool(this->device, &pool_info, nullptr, &this->ubo_descriptor_pool) != VK_SUCCESS)
-	{
+	if (vkCreateDescriptorPool(this->device, &pool_info, nullptr, &this->instance_descriptor_pool) != VK_SUCCESS)
 		return false;
+
+	VkDescriptorSetAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	alloc_info.pSetLayouts = &this->instance_descriptor_set_layout;
+	alloc_info.descriptorPool = this->instance_descriptor_pool;
+	alloc_info.descriptorSetCount = 1;
+
+	for (auto& frame : this->frames)
+	{
+		if (vkAllocateDescriptorSets(this->device, &alloc_info, &frame.instance_descriptor_set) != VK_SUCCESS)
+			return false;
 	}
 
+	update_instance_descriptor_sets();
+
 	return true;
 }
 
-bool VulkanApp::create_descriptor_sets()
+void VulkanApp::update_instance_descriptor_sets()
 {
-	std::vector<VkDescriptorSetLayout> layouts(swap_chain_images.size(), ubo_descriptor_set_layout);
+	if (this->instance_stream_layout != instance_layout::pulled)
+		return;
 
-	VkDescriptorSetAllocateInfo alloc_info = {};
-	alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	alloc_info.pSetLayouts = layouts.data();
-	alloc_info.descriptorPool = this->ubo_descriptor_pool;
-	alloc_info.descriptorSetCount = static_cast<uint32_t>(this->swap_chain_images.size());
+	for (uint32_t i = 0; i < this->frames_in_flight; ++i)
+	{
+		const VkDescriptorSet set = this->frames[i].instance_descriptor_set;
 
-	this->ubo_descriptor_sets.resize(swap_chain_images.size());
+		// The ids the cull passes wrote for this frame, indexed by gl_InstanceIndex
+		VkDescriptorBufferInfo ids_info = {};
+		ids_info.buffer = this->visible_ring.data.buffer;
+		ids_info.offset = this->visible_ring.get_offset(i) + this->visible_positions_offset;
+		ids_info.range = this->visible_colors_offset - this->visible_positions_offset;
 
-	if (vkAllocateDescriptorSets(this->device, &alloc_info, this->ubo_descriptor_sets.data()) != VK_SUCCESS)
-		return false;
+		VkDescriptorBufferInfo positions_info = {};
+		positions_info.buffer = this->positions_ring.data.buffer;
+		positions_info.offset = this->positions_ring.get_offset(i);
+		positions_info.range = this->positions_ring.slice_size;
 
-	for (size_t i = 0; i < this->swap_chain_images.size(); ++i)
-	{
-		VkDescriptorBufferInfo buffer_info = {};
-		buffer_info.offset = 0;
-		buffer_info.range = sizeof(UniformBufferObject);
-		buffer_info.buffer = this->ubo_buffers[i];
+		VkDescriptorBufferInfo colors_info = this->colors_buffer.get_descriptor_info();
+		VkDescriptorBufferInfo scales_info = this->scales_buffer.get_descriptor_info();
 
-		VkWriteDescriptorSet desc_write = {};
-		desc_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		desc_write.dstBinding = 0;
-		desc_write.descriptorCount = 1;
-		desc_write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		desc_write.dstSet = this->ubo_descriptor_sets[i];
-		desc_write.pBufferInfo = &buffer_info;
-		desc_write.dstArrayElement = 0;
+		std::vector<VkWriteDescriptorSet> writes =
+		{
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &ids_info),
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &positions_info),
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &colors_info),
+			initializers::write_descriptors_set(set, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &scales_info),
+		};
 
-		vkUpdateDescriptorSets(this->device, 1, &desc_write, 0, nullptr);
+		vkUpdateDescriptorSets(this->device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 	}
 }
 
@@ -1031,7 +1480,8 @@ bool VulkanApp::create_command_pool()
 
 	create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	create_info.queueFamilyIndex = this->family_indices.graphics_family.value();
-	create_info.flags = 0;
+	// Graphics command buffers are re-recorded every frame, compute ones when the instance count changes
+	create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
 	if (vkCreateCommandPool(this->device, &create_info, nullptr, &this->command_pool) != VK_SUCCESS)
 	{
@@ -1039,78 +1489,360 @@ bool VulkanApp::create_command_pool()
 		return false;
 	}
 
+	create_info.queueFamilyIndex = this->family_indices.compute_family.value();
+
+	if (vkCreateCommandPool(this->device, &create_info, nullptr, &this->compute_command_pool) != VK_SUCCESS)
+	{
+		log("Coudn't Create Compute Command Pool");
+		return false;
+	}
+
 	return true;
 }
 
 bool VulkanApp::create_command_buffers()
 {
-	this->command_buffers.resize(this->swap_chain_frame_buffers.size());
-
 	VkCommandBufferAllocateInfo cmd_buffer_alloc_info = {};
 	cmd_buffer_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	cmd_buffer_alloc_info.commandBufferCount = (uint32_t)this->command_buffers.size();
+	cmd_buffer_alloc_info.commandBufferCount = 1;
 	cmd_buffer_alloc_info.commandPool = this->command_pool;
 	cmd_buffer_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 
-	if (vkAllocateCommandBuffers(this->device, &cmd_buffer_alloc_info, this->command_buffers.data()) != VK_SUCCESS)
-	{
-		log("Couldn't Allocate Command Buffers");
-		return false;
-	}
-
-	for (auto i = 0; i < this->command_buffers.size(); ++i)
+	for (auto& frame : this->frames)
 	{
-		VkCommandBufferBeginInfo command_buffer_begin_info = {};
-		command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-		command_buffer_begin_info.pInheritanceInfo = nullptr; // all are primary now
-
-		if (vkBeginCommandBuffer(this->command_buffers[i], &command_buffer_begin_info) != VK_SUCCESS)
+		if (vkAllocateCommandBuffers(this->device, &cmd_buffer_alloc_info, &frame.command_buffer) != VK_SUCCESS)
 		{
-			log("Coudn't Begin Command Buffer");
+			log("Couldn't Allocate Command Buffers");
 			return false;
 		}
+	}
 
-		VkRenderPassBeginInfo render_pass_begin_info = {};
-		render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		render_pass_begin_info.clearValueCount = 1;
-		VkClearValue clear_color = { 0.01f, 0.01f, 0.01f, 1.0f };
-		render_pass_begin_info.pClearValues = &clear_color;
-		render_pass_begin_info.renderPass = this->render_pass;
-		render_pass_begin_info.framebuffer = this->swap_chain_frame_buffers[i];
-		render_pass_begin_info.renderArea.extent = this->swap_chain_extent;
-		render_pass_begin_info.renderArea.offset = { 0, 0 };
-
-		vkCmdBeginRenderPass(this->command_buffers[i], &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-		{
-			vkCmdBindPipeline(this->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, this->graphics_pipeline);
-			vkCmdSetViewport(this->command_buffers[i], 0, 1, &this->viewport);
-			vkCmdSetScissor(this->command_buffers[i], 0, 1, &this->scissor);
+	return create_secondary_command_buffers();
+}
 
-			VkBuffer vertex_buffers[] = { this->vertex_buffer };
-			VkBuffer colors_buffers[] = { this->colors_buffer };
-			VkBuffer positions_buffers[] = { this->positions_buffer };
-			VkBuffer scales_buffers[] = { this->scales_buffer };
-			VkDeviceSize offsets[] = { 0 };
+bool VulkanApp::create_secondary_command_buffers()
+{
+	if (!this->parallel_recording)
+		return true;
 
-			// Circles
-			vkCmdBindDescriptorSets(this->command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipeline_layout, 0, 1, &this->ubo_descriptor_sets[i], 0, nullptr);
+	// More slices than draws would stay empty, the sdf mode and a single level of detail only use the first one
+	const uint32_t max_draw_count = this->lod_buckets_enabled ? static_cast<uint32_t>(this->circle_lods.size()) : 1;
+	const uint32_t slice_count = std::min(this->jobs.get_thread_count(), max_draw_count);
 
-			vkCmdBindVertexBuffers(this->command_buffers[i], VERTEX_BUFFER_BIND_ID, 1, vertex_buffers, offsets);
+	VkCommandPoolCreateInfo pool_info = {};
+	pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pool_info.queueFamilyIndex = this->family_indices.graphics_family.value();
+	// Recorded again every frame, the whole pool is reset rather than its buffers one by one
+	pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-			vkCmdBindVertexBuffers(this->command_buffers[i], COLOR_BUFFER_BIND_ID, 1, colors_buffers, offsets);
+	VkCommandBufferAllocateInfo alloc_info = {};
+	alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	alloc_info.commandBufferCount = 1;
+	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
 
-			vkCmdBindVertexBuffers(this->command_buffers[i], POSITIONS_BUFFER_BIND_ID, 1, positions_buffers, offsets);
+	for (auto& frame : this->frames)
+	{
+		frame.secondary_pools.resize(slice_count, VK_NULL_HANDLE);
+		frame.secondary_command_buffers.resize(slice_count, VK_NULL_HANDLE);
 
-			vkCmdBindVertexBuffers(this->command_buffers[i], SCALE_BUFFER_BIND_ID, 1, scales_buffers, offsets);
+		for (uint32_t i = 0; i < slice_count; ++i)
+		{
+			if (vkCreateCommandPool(this->device, &pool_info, nullptr, &frame.secondary_pools[i]) != VK_SUCCESS)
+			{
+				log("Coudn't Create Secondary Command Pool");
+				return false;
+			}
+
+			alloc_info.commandPool = frame.secondary_pools[i];
+
+			if (vkAllocateCommandBuffers(this->device, &alloc_info, &frame.secondary_command_buffers[i]) != VK_SUCCESS)
+			{
+				log("Couldn't Allocate Secondary Command Buffers");
+				return false;
+			}
+		}
+	}
+
+	log("Parallel recording: " << slice_count << " secondary command buffers per frame, " << this->jobs.get_thread_count() << " threads");
+
+	return true;
+}
+
+bool VulkanApp::record_command_buffer(FrameContext& frame, const uint32_t& frame_index, const uint32_t& image_index)
+{
+	const VkCommandBuffer command_buffer = frame.command_buffer;
+
+	// The previous frame of this context has finished, its recording is no longer executing
+	vkResetCommandBuffer(command_buffer, 0);
+
+	VkCommandBufferBeginInfo command_buffer_begin_info = {};
+	command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	command_buffer_begin_info.pInheritanceInfo = nullptr;
+
+	if (vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info) != VK_SUCCESS)
+	{
+		log("Coudn't Begin Command Buffer");
+		return false;
+	}
+
+	if (!this->compute_timestamps)
+		this->profiler.reset_gpu_frame(command_buffer, frame_index);
+
+	// Take the visible slice over from the compute family, culling released it at the end of its last pass
+	if (this->family_indices.compute_family != this->family_indices.graphics_family)
+	{
+		VkBufferMemoryBarrier acquire = initializers::buffer_memory_barrier();
+		acquire.srcAccessMask = 0;
+		acquire.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		acquire.srcQueueFamilyIndex = this->family_indices.compute_family.value();
+		acquire.dstQueueFamilyIndex = this->family_indices.graphics_family.value();
+		acquire.buffer = this->visible_ring.data.buffer;
+		acquire.offset = this->visible_ring.get_offset(frame_index);
+		acquire.size = this->visible_ring.slice_size;
+
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr, 1, &acquire, 0, nullptr);
+	}
+
+	VkRenderPassBeginInfo render_pass_begin_info = {};
+	render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	render_pass_begin_info.clearValueCount = 1;
+	VkClearValue clear_color = { 0.01f, 0.01f, 0.01f, 1.0f };
+	render_pass_begin_info.pClearValues = &clear_color;
+	render_pass_begin_info.renderPass = this->render_pass;
+	render_pass_begin_info.framebuffer = this->swap_chain_frame_buffers[image_index];
+	render_pass_begin_info.renderArea.extent = this->swap_chain_extent;
+	render_pass_begin_info.renderArea.offset = { 0, 0 };
+
+	this->profiler.begin_gpu(command_buffer, frame_index, this->profile_scopes.render_pass);
+
+	// One draw per level of detail bucket, instance counts and ranges come from the cull passes
+	const uint32_t draw_count = this->render_mode == circle_render_mode::sdf || !this->lod_buckets_enabled ? 1 : static_cast<uint32_t>(this->circle_lods.size());
+
+	if (this->parallel_recording)
+	{
+		vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+		if (!record_secondary_command_buffers(frame, frame_index, image_index, draw_count))
+			return false;
+	}
+	else
+	{
+		vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+		record_draws(command_buffer, frame, frame_index, 0, draw_count);
+	}
+
+	vkCmdEndRenderPass(command_buffer);
+
+	this->profiler.end_gpu(command_buffer, frame_index, this->profile_scopes.render_pass);
+
+	if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS)
+	{
+		log("vkEndCommandBuffer Failed.");
+		return false;
+	}
+
+	return true;
+}
+
+void VulkanApp::record_draws(VkCommandBuffer command_buffer, const FrameContext& frame, const uint32_t& frame_index, const uint32_t& first_draw, const uint32_t& draw_count) const
+{
+	const bool sdf = this->render_mode == circle_render_mode::sdf;
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, sdf ? this->sdf_pipeline : this->graphics_pipeline);
+	vkCmdSetViewport(command_buffer, 0, 1, &this->viewport);
+	vkCmdSetScissor(command_buffer, 0, 1, &this->scissor);
+
+	const VkDeviceSize visible_offset = this->visible_ring.get_offset(frame_index);
+
+	VkBuffer vertex_buffers[] = { this->vertex_buffer.buffer };
+	VkBuffer visible_buffers[] = { this->visible_ring.data.buffer };
+	VkDeviceSize offsets[] = { 0 };
+	VkDeviceSize colors_offsets[] = { visible_offset + this->visible_colors_offset };
+	VkDeviceSize positions_offsets[] = { visible_offset + this->visible_positions_offset };
+	VkDeviceSize scales_offsets[] = { visible_offset + this->visible_scales_offset };
+
+	// Circles
+	vkCmdPushConstants(command_buffer, this->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(this->camera), &this->camera);
+
+	if (!sdf)
+		vkCmdBindVertexBuffers(command_buffer, VERTEX_BUFFER_BIND_ID, 1, vertex_buffers, offsets);
+
+	if (this->instance_stream_layout == instance_layout::pulled)
+	{
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipeline_layout, 0, 1, &frame.instance_descriptor_set, 0, nullptr);
+	}
+	else if (this->instance_stream_layout == instance_layout::packed)
+	{
+		vkCmdBindVertexBuffers(command_buffer, PACKED_INSTANCE_BIND_ID, 1, visible_buffers, positions_offsets);
+	}
+	else
+	{
+		vkCmdBindVertexBuffers(command_buffer, COLOR_BUFFER_BIND_ID, 1, visible_buffers, colors_offsets);
+
+		vkCmdBindVertexBuffers(command_buffer, POSITIONS_BUFFER_BIND_ID, 1, visible_buffers, positions_offsets);
+
+		vkCmdBindVertexBuffers(command_buffer, SCALE_BUFFER_BIND_ID, 1, visible_buffers, scales_offsets);
+	}
 
-			vkCmdBindIndexBuffer(this->command_buffers[i], this->index_buffer, 0, VK_INDEX_TYPE_UINT16);
+	vkCmdBindIndexBuffer(command_buffer, this->index_buffer.buffer, 0, VK_INDEX_TYPE_UINT16);
 
-			vkCmdDrawIndexed(this->command_buffers[i], static_cast<uint32_t>(this->circle_model.indices.size()), instance_count, 0, 0, 0);
+	// The commands sit at the start of the visible slice, one per level of detail
+	for (uint32_t lod = first_draw; lod < first_draw + draw_count; ++lod)
+		vkCmdDrawIndexedIndirect(command_buffer, this->visible_ring.data.buffer, visible_offset + sizeof(VkDrawIndexedIndirectCommand) * lod, 1, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+bool VulkanApp::record_secondary_command_buffers(FrameContext& frame, const uint32_t& frame_index, const uint32_t& image_index, const uint32_t& draw_count)
+{
+	const uint32_t slice_count = std::min(static_cast<uint32_t>(frame.secondary_command_buffers.size()), draw_count);
+
+	VkCommandBufferInheritanceInfo inheritance_info = {};
+	inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance_info.renderPass = this->render_pass;
+	inheritance_info.subpass = 0;
+	inheritance_info.framebuffer = this->swap_chain_frame_buffers[image_index];
+
+	std::atomic<bool> failed{ false };
+
+	this->jobs.parallel_for(this->record_job, slice_count, 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t slice = begin; slice < end; ++slice)
+		{
+			// The previous frame of this context has finished, nothing allocated from the pool is executing anymore
+			vkResetCommandPool(this->device, frame.secondary_pools[slice], 0);
+
+			const VkCommandBuffer command_buffer = frame.secondary_command_buffers[slice];
+
+			VkCommandBufferBeginInfo begin_info = {};
+			begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+			begin_info.pInheritanceInfo = &inheritance_info;
+
+			if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS)
+			{
+				failed = true;
+				continue;
+			}
+
+			// Contiguous buckets, the first slices take one fewer when they don't divide evenly
+			const uint32_t first_draw = draw_count * slice / slice_count;
+			const uint32_t end_draw = draw_count * (slice + 1) / slice_count;
+			record_draws(command_buffer, frame, frame_index, first_draw, end_draw - first_draw);
+
+			if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS)
+				failed = true;
+		}
+	});
+
+	if (failed)
+	{
+		log("Couldn't Record Secondary Command Buffers");
+		return false;
+	}
+
+	vkCmdExecuteCommands(frame.command_buffer, slice_count, frame.secondary_command_buffers.data());
+
+	return true;
+}
+
+bool VulkanApp::create_compute_command_buffers()
+{
+	VkCommandBufferAllocateInfo cmd_buffer_alloc_info = {};
+	cmd_buffer_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmd_buffer_alloc_info.commandBufferCount = 1;
+	cmd_buffer_alloc_info.commandPool = this->compute_command_pool;
+	cmd_buffer_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+	for (auto& frame : this->frames)
+	{
+		if (vkAllocateCommandBuffers(this->device, &cmd_buffer_alloc_info, &frame.compute_command_buffer) != VK_SUCCESS)
+		{
+			log("Couldn't Allocate Compute Command Buffers");
+			return false;
 		}
-		vkCmdEndRenderPass(this->command_buffers[i]);
+	}
+
+	return record_compute_command_buffers();
+}
+
+bool VulkanApp::record_compute_command_buffers()
+{
+	const uint32_t group_size = 256; // local_size_x in simulate.comp and cull.comp
+	const uint32_t group_count = (this->instance_count + group_size - 1) / group_size;
+
+	// Dispatches of one submit (and of consecutive frames) share the simulation state and the cull groups
+	const VkMemoryBarrier compute_barrier = initializers::memory_barrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
 
-		if (vkEndCommandBuffer(this->command_buffers[i]) != VK_SUCCESS)
+	for (uint32_t i = 0; i < this->frames_in_flight; ++i)
+	{
+		const VkCommandBuffer command_buffer = this->frames[i].compute_command_buffer;
+
+		VkCommandBufferBeginInfo command_buffer_begin_info = {};
+		command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+		if (vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info) != VK_SUCCESS)
+		{
+			log("Coudn't Begin Compute Command Buffer");
+			return false;
+		}
+
+		// Compute executes first every frame, the whole query range of the frame is reset here
+		const bool timestamps = this->compute_timestamps;
+		if (timestamps)
+			this->profiler.reset_gpu_frame(command_buffer, i);
+
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &compute_barrier, 0, nullptr, 0, nullptr);
+
+		// All passes share the layout, the set stays bound across pipeline switches
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, this->compute_pipeline_layout, 0, 1, &this->frames[i].compute_descriptor_set, 0, nullptr);
+
+		// The CPU simulation has already written this frame's positions slice
+		if (!this->cpu_physics)
+		{
+			if (timestamps)
+				this->profiler.begin_gpu(command_buffer, i, this->profile_scopes.simulate);
+
+			vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, this->compute_pipeline);
+			vkCmdDispatch(command_buffer, group_count, 1, 1);
+
+			if (timestamps)
+				this->profiler.end_gpu(command_buffer, i, this->profile_scopes.simulate);
+		}
+
+		if (timestamps)
+			this->profiler.begin_gpu(command_buffer, i, this->profile_scopes.cull);
+
+		// Cull: count visible per group, scan the counts (single group), scatter into the visible streams
+		const uint32_t pass_groups[3] = { group_count, 1, group_count };
+
+		for (uint32_t pass = 0; pass < 3; ++pass)
+		{
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &compute_barrier, 0, nullptr, 0, nullptr);
+
+			vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, this->cull_pipelines[pass]);
+			vkCmdDispatch(command_buffer, pass_groups[pass], 1, 1);
+		}
+
+		if (timestamps)
+			this->profiler.end_gpu(command_buffer, i, this->profile_scopes.cull);
+
+		// Hand the visible slice to the graphics family. The previous contents are never needed,
+		// so the slice is not transferred back before the next frame overwrites it.
+		if (this->family_indices.compute_family != this->family_indices.graphics_family)
+		{
+			VkBufferMemoryBarrier release = initializers::buffer_memory_barrier();
+			release.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			release.dstAccessMask = 0;
+			release.srcQueueFamilyIndex = this->family_indices.compute_family.value();
+			release.dstQueueFamilyIndex = this->family_indices.graphics_family.value();
+			release.buffer = this->visible_ring.data.buffer;
+			release.offset = this->visible_ring.get_offset(i);
+			release.size = this->visible_ring.slice_size;
+
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &release, 0, nullptr);
+		}
+
+		if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS)
 		{
 			log("vkEndCommandBuffer Failed.");
 			return false;
@@ -1122,11 +1854,8 @@ bool VulkanApp::create_command_buffers()
 
 bool VulkanApp::create_sync_objects()
 {
-	this->num_frames = this->swap_chain_images.size();
-
-	this->image_available_semaphore.resize(this->num_frames);
-	this->render_finished_semaphore.resize(this->num_frames);
-	this->draw_fences.resize(this->num_frames);
+	// Stays fixed across swap chain recreation, the per-frame resources and rings are sized from it
+	this->frames.resize(this->frames_in_flight);
 
 	VkSemaphoreCreateInfo semaphore_info = {};
 	semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -1136,77 +1865,141 @@ bool VulkanApp::create_sync_objects()
 	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-	for (auto i = 0; i < this->num_frames; ++i)
+	for (auto& frame : this->frames)
 	{
-		if (vkCreateSemaphore(this->device, &semaphore_info, nullptr, &this->image_available_semaphore[i]) != VK_SUCCESS
-			|| vkCreateSemaphore(this->device, &semaphore_info, nullptr, &this->render_finished_semaphore[i]) != VK_SUCCESS
-			|| vkCreateFence(this->device, &fence_info, nullptr, &this->draw_fences[i]) != VK_SUCCESS)
+		if (vkCreateSemaphore(this->device, &semaphore_info, nullptr, &frame.image_available) != VK_SUCCESS
+			|| vkCreateSemaphore(this->device, &semaphore_info, nullptr, &frame.render_finished) != VK_SUCCESS)
+		{
+			log("Couldn't Create Semaphores.");
+			return false;
+		}
+
+		if (this->timeline_semaphores)
+			continue;
+
+		if (vkCreateSemaphore(this->device, &semaphore_info, nullptr, &frame.compute_finished) != VK_SUCCESS
+			|| vkCreateFence(this->device, &fence_info, nullptr, &frame.fence) != VK_SUCCESS)
 		{
 			log("Couldn't Create Semaphores.");
 			return false;
 		}
 	}
 
+	if (this->timeline_semaphores && (!this->graphics_timeline.initialize(this->device) || !this->compute_timeline.initialize(this->device)))
+	{
+		log("Couldn't Create Timeline Semaphores.");
+		return false;
+	}
+
 	return true;
 }
 
+void VulkanApp::wait_frames_in_flight()
+{
+	if (this->timeline_semaphores)
+	{
+		this->graphics_timeline.wait(this->submitted_frames);
+		return;
+	}
+
+	for (const auto& frame : this->frames)
+		vkWaitForFences(this->device, 1, &frame.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+}
+
+bool VulkanApp::wait_for_frame(const uint64_t& frame_number)
+{
+	if (this->timeline_semaphores)
+		return this->graphics_timeline.wait(frame_number);
+
+	if (frame_number == 0)
+		return true;
+
+	// Frames go through the contexts round robin, a context submitted again since then only makes this wait longer
+	const auto& frame = this->frames[(frame_number - 1) % this->frames_in_flight];
+	return vkWaitForFences(this->device, 1, &frame.fence, VK_TRUE, std::numeric_limits<uint64_t>::max()) == VK_SUCCESS;
+}
+
 bool VulkanApp::cleanup_swap_chain()
 {
 	for (auto& frame_buffer : this->swap_chain_frame_buffers)
 		vkDestroyFramebuffer(this->device, frame_buffer, nullptr);
 
-	vkFreeCommandBuffers(this->device, this->command_pool, this->num_frames, this->command_buffers.data());
-
 	vkDestroyRenderPass(this->device, this->render_pass, nullptr);
 
 	for (auto& image_view : this->swap_chain_image_views)
 		vkDestroyImageView(this->device, image_view, nullptr);
 
-	vkDestroySwapchainKHR(this->device, this->swap_chain, nullptr);
-
-	for (size_t i = 0; i < this->swap_chain_images.size(); ++i)
+	if (this->headless)
 	{
-		vkDestroyBuffer(this->device, this->ubo_buffers[i], nullptr);
-		vkFreeMemory(this->device, this->ubo_buffers_memory[i], nullptr);
+		for (auto& offscreen_image : this->offscreen_images)
+			offscreen_image.destroy(this->device, this->allocator);
+		this->offscreen_images.clear();
+	}
+	else
+	{
+		vkDestroySwapchainKHR(this->device, this->swap_chain, nullptr);
 	}
-
-	vkDestroyDescriptorPool(this->device, this->ubo_descriptor_pool, nullptr);
 
 	return true;
 }
 
 bool VulkanApp::recreate_swap_chain()
 {
-	vkDeviceWaitIdle(this->device);
-
+	// Minimized, stays pending until the window has an area again
 	int width = 0, height = 0;
-	while (width == 0 || height == 0)
+	glfwGetFramebufferSize(this->window, &width, &height);
+	if (width == 0 || height == 0)
+		return true;
+
+	// Frames in flight may still render to and present the old images. Only the extent dependent objects are replaced,
+	// the old ones are retired into the deletion queue, nothing waits for the device here.
+	const VkSwapchainKHR old_swap_chain = this->swap_chain;
+	const std::vector<VkImageView> old_image_views = std::move(this->swap_chain_image_views);
+	const std::vector<VkFramebuffer> old_frame_buffers = std::move(this->swap_chain_frame_buffers);
+	const VkFormat old_format = this->swap_chain_image_format;
+	const VkRenderPass old_render_pass = this->render_pass;
+	this->swap_chain_image_views.clear();
+	this->swap_chain_frame_buffers.clear();
+
+	const bool created = create_swap_chain();
+
+	// A frame's fence (or timeline value) covers its rendering but not its present, which waits on render_finished
+	// afterwards. The old swap chain goes once frames_in_flight more frames have completed: by then every frame context
+	// has signaled its render_finished again for the new swap chain, which it can only do after the old present
+	// waiting on that semaphore has consumed it. So no present on the old swap chain is pending anymore.
+	const VkDevice device = this->device;
+	this->deletions.push(this->submitted_frames + this->frames_in_flight, [device, old_swap_chain, old_image_views, old_frame_buffers]()
 	{
-		glfwGetFramebufferSize(this->window, &width, &height);
-		glfwWaitEvents();
+		for (auto frame_buffer : old_frame_buffers)
+			vkDestroyFramebuffer(device, frame_buffer, nullptr);
+		for (auto image_view : old_image_views)
+			vkDestroyImageView(device, image_view, nullptr);
+		vkDestroySwapchainKHR(device, old_swap_chain, nullptr);
+	});
+
+	if (!created)
+	{
+		this->swap_chain = VK_NULL_HANDLE;
+		return false;
 	}
 
-	if (!cleanup_swap_chain())
-		return false;
+	// The render pass and the pipelines built against it only depend on the format, which a resize doesn't change in practice
+	if (this->swap_chain_image_format != old_format)
+	{
+		this->deletions.push(this->submitted_frames, [device, old_render_pass]() { vkDestroyRenderPass(device, old_render_pass, nullptr); });
+
+		if (!create_renderpass() || !recreate_pipelines())
+			return false;
+	}
 
-	if (!create_swap_chain())
-		return false;
 	if (!create_image_views())
 		return false;
-	if (!create_renderpass())
-		return false;
 	if (!set_viewport_scissor())
 		return false;
 	if (!create_frame_buffers())
 		return false;
-	if (!create_uniform_buffers())
-		return false;
-	if (!create_descriptor_pool())
-		return false;
-	if (!create_descriptor_sets())
-		return false;
-	if (!create_command_buffers())
-		return false;
+
+	this->should_recreate_swapchain = false;
 
 	return true;
 }
@@ -1228,7 +2021,7 @@ bool VulkanApp::set_viewport_scissor()
 	return true;
 }
 
-void VulkanApp::update(const uint32_t& current_image)
+void VulkanApp::update()
 {
 	static auto start_time = std::chrono::high_resolution_clock::now();
 
@@ -1236,105 +2029,290 @@ void VulkanApp::update(const uint32_t& current_image)
 
 	float time = std::chrono::duration<float, std::chrono::seconds::period>(now - start_time).count();
 
-	void* data;
-	static const auto positions_update_size = sizeof(glm::vec2) * instance_count;
-	vkMapMemory(this->device, this->positions_buffer_memory, 0, positions_update_size, 0, &data);
-	memcpy(data, this->circles.positions.data(), positions_update_size);
-	vkUnmapMemory(this->device, this->positions_buffer_memory);
+	static auto last_update = now;
+	// Clamped so a stall (window drag, resize) doesn't tunnel circles through the edges
+	const float dt = std::min(std::chrono::duration<float, std::chrono::seconds::period>(now - last_update).count(), 0.05f);
+	last_update = now;
+
+	// The previous frame of this context has been waited on, so the simulation is done reading its params slice
+	FrameParams params = {};
+	params.extent = glm::vec2(static_cast<float>(this->swap_chain_extent.width), static_cast<float>(this->swap_chain_extent.height));
+	params.dt = dt;
+	params.count = this->instance_count;
+	params.view_min = this->camera_position;
+	params.view_max = this->camera_position + params.extent / this->camera_zoom;
+
+	// Levels the cull passes bucket the visible circles into, a single one covering every size when there's nothing to choose from
+	const auto set_lod = [&params](const uint32_t& slot, const model_lod& lod, const float& max_radius)
+	{
+		params.lods[slot] = { max_radius, lod.first_index, lod.index_count, lod.vertex_offset };
+	};
 
-	UniformBufferObject ubo = {};
+	if (this->render_mode == circle_render_mode::sdf)
+	{
+		params.lod_count = 1;
+		set_lod(0, this->quad_lod, std::numeric_limits<float>::max());
+	}
+	else if (!this->lod_buckets_enabled)
+	{
+		params.lod_count = 1;
+		set_lod(0, this->circle_lods[this->circle_lods.size() / 2], std::numeric_limits<float>::max());
+	}
+	else
+	{
+		params.lod_count = static_cast<uint32_t>(this->circle_lods.size());
+		for (uint32_t lod = 0; lod < params.lod_count; ++lod)
+			set_lod(lod, this->circle_lods[lod], this->circle_lods[lod].max_radius);
+	}
+
+	memcpy(this->frame_params_ring.get_slice(this->current_frame), &params, sizeof(params));
+
+	if (this->cpu_physics)
+	{
+		this->profiler.begin_cpu(this->profile_scopes.physics);
+
+		glm::vec2* positions = static_cast<glm::vec2*>(this->positions_ring.get_slice(this->current_frame));
+
+		if (this->simulation.is_running())
+		{
+			// Ticks on its own schedule, this only blends the latest snapshot
+			this->simulation.set_extent(params.extent);
+			this->simulation.write_positions(positions, this->instance_count);
+		}
+		else
+		{
+			this->physics.extent = params.extent;
+			this->physics.advance(dt);
+			this->physics.write_positions(positions, 0, this->instance_count);
+		}
+
+		this->profiler.end_cpu();
+	}
 
-	ubo.view = glm::lookAt(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	view = glm::scale(glm::mat4(1.0f), glm::vec3(this->camera_zoom, this->camera_zoom, 1.0f))
+		* glm::translate(glm::mat4(1.0f), glm::vec3(-this->camera_position, 0.0f))
+		* view;
 
-	ubo.proj = glm::ortho(0.0f, static_cast<float>(this->swap_chain_extent.width), static_cast<float>(this->swap_chain_extent.height), 0.0f, -1000.0f, 1000.0f);
+	const glm::mat4 proj = glm::ortho(0.0f, static_cast<float>(this->swap_chain_extent.width), static_cast<float>(this->swap_chain_extent.height), 0.0f, -1000.0f, 1000.0f);
 
-	vkMapMemory(this->device, this->ubo_buffers_memory[current_image], 0, sizeof(ubo), 0, &data);
-	memcpy(data, &ubo, sizeof(ubo));
-	vkUnmapMemory(this->device, this->ubo_buffers_memory[current_image]);
+	// Nothing is written to memory, record_command_buffer() pushes these
+	this->camera.view_proj = proj * view;
+	this->camera.screen_to_clip = glm::vec4(proj[0][0], proj[1][1], proj[3][0], proj[3][1]);
+	this->camera.zoom = this->camera_zoom;
 }
 
 bool VulkanApp::draw_frame()
 {
-	vkWaitForFences(this->device, 1, &this->draw_fences[this->current_frame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-
-	// image_index vs current_frame
-	uint32_t image_index;
+	TRACE_SCOPE("draw_frame");
 
-	const auto acq_image_result = vkAcquireNextImageKHR(
-		this->device,
-		this->swap_chain,
-		std::numeric_limits<uint64_t>::max(),
-		this->image_available_semaphore[this->current_frame],
-		VK_NULL_HANDLE,
-		&image_index);
-
-	if (acq_image_result == VK_SUBOPTIMAL_KHR
-		|| acq_image_result == VK_ERROR_OUT_OF_DATE_KHR
-		|| this->should_recreate_swapchain)
+	if (!this->headless && this->should_recreate_swapchain)
 	{
-		if (recreate_swap_chain())
+		if (!recreate_swap_chain())
 		{
-			this->should_recreate_swapchain = false;
-			log("SwapChain Recreate");
-			return true;
+			log("Failed SwapChain Recreatation.");
+			return false;
 		}
-		else
+
+		// Still minimized, nothing to render to
+		if (this->should_recreate_swapchain)
 		{
-			log("Failed SwapChain Recreatation.");
+			glfwWaitEvents();
+			return true;
 		}
+
+		log("SwapChain Recreate");
+	}
+
+	auto& frame = this->frames[this->current_frame];
+
+	this->profiler.begin_cpu(this->profile_scopes.wait);
+	const bool waited = wait_for_frame(frame.submitted_frame);
+	this->profiler.end_cpu();
+
+	if (!waited)
+	{
+		log("Waiting for frame " << frame.submitted_frame << " failed");
+		return false;
 	}
 
-	VkSemaphore wait_semaphores[] = { this->image_available_semaphore[this->current_frame] };
-	VkSemaphore singnal_semaphores[] = { this->render_finished_semaphore[this->current_frame] };
-	VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	// Frames complete in submission order, everything retired up to this one is unused now
+	this->deletions.collect(frame.submitted_frame);
+
+	this->profiler.collect(this->current_frame);
+	this->uploader.recycle_semaphores(frame.upload_wait_semaphores);
+	release_retired_buffers(false);
+
+	uint32_t image_index;
+
+	VkResult acq_image_result = VK_SUCCESS;
+
+	if (this->headless)
+	{
+		image_index = this->next_offscreen_image;
+		this->next_offscreen_image = (this->next_offscreen_image + 1) % offscreen_image_count;
+	}
+	else
+	{
+		this->profiler.begin_cpu(this->profile_scopes.acquire);
+		acq_image_result = vkAcquireNextImageKHR(
+			this->device,
+			this->swap_chain,
+			std::numeric_limits<uint64_t>::max(),
+			frame.image_available,
+			VK_NULL_HANDLE,
+			&image_index);
+		this->profiler.end_cpu();
+	}
+
+	// Nothing was acquired, the next frame starts with a new swap chain. A suboptimal image is still rendered and
+	// presented, the swap chain is replaced after that.
+	if (acq_image_result == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		this->should_recreate_swapchain = true;
+		return true;
+	}
+
+	const uint64_t frame_number = this->submitted_frames + 1;
+
+	// With more images than frames in flight the driver can hand back an image an older frame is still rendering to
+	if (!wait_for_frame(this->images_in_flight[image_index]))
+	{
+		log("Waiting for frame " << this->images_in_flight[image_index] << " failed");
+		return false;
+	}
+	this->images_in_flight[image_index] = frame_number;
 
 	// Update UBO
-	update(image_index);
+	this->profiler.begin_cpu(this->profile_scopes.update);
+	update();
+	this->profiler.end_cpu();
+
+	this->profiler.begin_cpu(this->profile_scopes.record);
+	const bool recorded = record_command_buffer(frame, this->current_frame, image_index);
+	this->profiler.end_cpu();
+
+	if (!recorded)
+		return false;
+
+	this->profiler.begin_cpu(this->profile_scopes.submit);
+
+	// Simulation runs on the compute queue while the graphics queue may still be busy with the previous frame.
+	// Uploads flushed since the last frame are waited on here, the graphics submit inherits them through the compute semaphore.
+	std::vector<VkSemaphore> upload_semaphores;
+	std::vector<uint64_t> upload_values;
+
+	if (this->timeline_semaphores)
+	{
+		// Waiting for a value the transfer queue reached long ago costs nothing, no need to track which batches are new
+		upload_semaphores.push_back(this->uploader.get_timeline());
+		upload_values.push_back(this->uploader.get_last_submitted());
+	}
+	else
+	{
+		this->uploader.take_wait_semaphores(frame.upload_wait_semaphores);
+		upload_semaphores = frame.upload_wait_semaphores;
+	}
+
+	std::vector<VkPipelineStageFlags> upload_wait_stages(upload_semaphores.size(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+	const VkSemaphore compute_signal = this->timeline_semaphores ? this->compute_timeline.get() : frame.compute_finished;
+
+	// Chained with timeline semaphores only, the values of the frame and the upload batches
+	VkTimelineSemaphoreSubmitInfoKHR compute_values = {};
+	compute_values.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	compute_values.waitSemaphoreValueCount = static_cast<uint32_t>(upload_values.size());
+	compute_values.pWaitSemaphoreValues = upload_values.data();
+	compute_values.signalSemaphoreValueCount = 1;
+	compute_values.pSignalSemaphoreValues = &frame_number;
+
+	VkSubmitInfo compute_submit_info = {};
+	compute_submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	compute_submit_info.pNext = this->timeline_semaphores ? &compute_values : nullptr;
+	compute_submit_info.commandBufferCount = 1;
+	compute_submit_info.pCommandBuffers = &frame.compute_command_buffer;
+	compute_submit_info.waitSemaphoreCount = static_cast<uint32_t>(upload_semaphores.size());
+	compute_submit_info.pWaitSemaphores = upload_semaphores.data();
+	compute_submit_info.pWaitDstStageMask = upload_wait_stages.data();
+	compute_submit_info.signalSemaphoreCount = 1;
+	compute_submit_info.pSignalSemaphores = &compute_signal;
+
+	if (vkQueueSubmit(this->compute_queue, 1, &compute_submit_info, VK_NULL_HANDLE) != VK_SUCCESS)
+	{
+		this->profiler.end_cpu();
+		log("vkQueueSubmit Failed (Compute)");
+		return false;
+	}
+
+	// Offscreen images are never acquired or presented, only the compute semaphore is left to wait on
+	VkSemaphore wait_semaphores[] = { compute_signal, frame.image_available };
+	// The binary image semaphores ignore their values
+	const uint64_t wait_values[] = { frame_number, 0 };
+	// The pulled layout reads the culled ids and the positions from the vertex shader
+	VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+
+	// The graphics timeline takes the place of the fence, presenting still needs the binary semaphore
+	VkSemaphore signal_semaphores[] = { this->graphics_timeline.get(), frame.render_finished };
+	const uint64_t signal_values[] = { frame_number, 0 };
+	const uint32_t first_signal = this->timeline_semaphores ? 0 : 1;
+
+	VkTimelineSemaphoreSubmitInfoKHR graphics_values = {};
+	graphics_values.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	graphics_values.waitSemaphoreValueCount = this->headless ? 1 : 2;
+	graphics_values.pWaitSemaphoreValues = wait_values;
+	graphics_values.signalSemaphoreValueCount = this->headless ? 1 : 2;
+	graphics_values.pSignalSemaphoreValues = signal_values;
 
 	VkSubmitInfo submit_info = {};
 	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pNext = this->timeline_semaphores ? &graphics_values : nullptr;
 	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &this->command_buffers[image_index];
-	submit_info.waitSemaphoreCount = 1;
+	submit_info.pCommandBuffers = &frame.command_buffer;
+	submit_info.waitSemaphoreCount = this->headless ? 1 : 2;
 	submit_info.pWaitSemaphores = wait_semaphores;
 	submit_info.pWaitDstStageMask = wait_stages;
-	submit_info.signalSemaphoreCount = 1;
-	submit_info.pSignalSemaphores = singnal_semaphores;
+	submit_info.signalSemaphoreCount = (this->headless ? 1 : 2) - first_signal;
+	submit_info.pSignalSemaphores = signal_semaphores + first_signal;
+
+	if (!this->timeline_semaphores)
+		vkResetFences(this->device, 1, &frame.fence);
+
+	const auto submit_result = vkQueueSubmit(this->graphics_queue, 1, &submit_info, frame.fence);
+	frame.submitted_frame = this->submitted_frames = frame_number;
+	this->profiler.end_cpu();
 
-	vkResetFences(this->device, 1, &this->draw_fences[this->current_frame]);
-	if (vkQueueSubmit(this->graphics_queue, 1, &submit_info, this->draw_fences[this->current_frame]) != VK_SUCCESS)
+	if (submit_result != VK_SUCCESS)
 	{
 		log("vkQueueSubmit Failed");
 		return false;
 	}
 
+	this->profiler.mark_submitted(this->current_frame);
+
+	if (this->headless)
+	{
+		this->current_frame = (this->current_frame + 1) % this->frames_in_flight;
+		return true;
+	}
+
 	VkPresentInfoKHR present_info = {};
 
 	VkSwapchainKHR swap_chains[] = { this->swap_chain };
 	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	present_info.pImageIndices = &image_index;
 	present_info.waitSemaphoreCount = 1;
-	present_info.pWaitSemaphores = singnal_semaphores;
+	present_info.pWaitSemaphores = &frame.render_finished;
 	present_info.pResults = nullptr;
 	present_info.pSwapchains = swap_chains;
 	present_info.swapchainCount = 1;
 
+	this->profiler.begin_cpu(this->profile_scopes.present);
 	const auto present_result = vkQueuePresentKHR(this->present_queue, &present_info);
-	if (present_result == VK_SUBOPTIMAL_KHR || present_result == VK_ERROR_OUT_OF_DATE_KHR || this->should_recreate_swapchain)
-	{
-		if (recreate_swap_chain())
-		{
-			this->should_recreate_swapchain = false;
-			log("SwapChain Recreate");
-			return true;
-		}
-		else
-		{
-			log("Failed SwapChain Recreatation.");
-		}
-	}
+	this->profiler.end_cpu();
+	if (present_result == VK_SUBOPTIMAL_KHR || present_result == VK_ERROR_OUT_OF_DATE_KHR)
+		this->should_recreate_swapchain = true;
 
-	this->current_frame = (this->current_frame + 1) % this->num_frames;
+	this->current_frame = (this->current_frame + 1) % this->frames_in_flight;
 
 	return true;
 }
@@ -1343,18 +2321,32 @@ bool VulkanApp::main_loop()
 {
 	this->last_timestamp = std::chrono::high_resolution_clock::now();
 
-	while (!glfwWindowShouldClose(this->window))
+	const uint32_t frame_limit = this->measured_frames > 0 ? this->warmup_frames + this->measured_frames : 0;
+
+	for (uint32_t frame = 0; !glfwWindowShouldClose(this->window) && (frame_limit == 0 || frame < frame_limit); ++frame)
 	{
-		const auto t_start = std::chrono::high_resolution_clock::now();
+		if (frame_limit > 0 && frame == this->warmup_frames)
+			begin_measured_frames();
+
+		this->profiler.begin_cpu(this->profile_scopes.frame);
+
+		if (this->requested_instance_count != this->instance_count && !resize_instance_buffers(this->requested_instance_count))
+			return false;
+
+		if (this->requested_render_mode != this->render_mode && !switch_render_mode())
+			return false;
+
+		if (this->shaders.poll_changes() && !recreate_pipelines())
+			return false;
 
 		if (!draw_frame())
 			return false;
 
+		this->profiler.end_cpu();
+
 		const auto t_end = std::chrono::high_resolution_clock::now();
-		const auto t_diff = std::chrono::duration<double, std::milli>(t_end - t_start).count();
 
 		this->frame_counter++;
-		this->frame_timer = (float)t_diff;
 
 		float fps_timer = std::chrono::duration<double, std::milli>(t_end - this->last_timestamp).count();
 
@@ -1362,10 +2354,8 @@ bool VulkanApp::main_loop()
 		{
 			this->last_fps = static_cast<uint32_t>((float)frame_counter * (1000.0f / fps_timer));
 
-			sprintf_s(title, "%d FPS in %.8f (ms)", this->last_fps, this->frame_timer);
-
-			sum_time += fps_timer;
-			count_frames += this->frame_counter;
+			sprintf_s(title, "%d FPS - %u circles (%s)", this->last_fps, this->instance_count,
+				this->render_mode == circle_render_mode::sdf ? "sdf" : "mesh");
 
 			glfwSetWindowTitle(this->window, title);
 
@@ -1375,19 +2365,101 @@ bool VulkanApp::main_loop()
 
 		glfwPollEvents();
 
-		if (count_frames > 500)
+		// Limited runs report once at the end
+		if (frame_limit == 0 && ++this->frames_since_report >= profile_report_interval)
 		{
-			std::cout << "Average Frame Time: " << (float)sum_time / count_frames << std::endl;
-			sum_time = 0;
-			count_frames = 0;
-			//return true;
+			std::cout << "Last " << this->frames_since_report << " frames"
+				<< " (" << (this->render_mode == circle_render_mode::sdf ? "sdf" : "mesh")
+				<< ", " << get_instance_layout_name(this->instance_stream_layout) << " instances, " << this->instance_count << " circles, zoom " << this->camera_zoom
+				<< ", " << this->frames_in_flight << " frames in flight)" << std::endl;
+			this->profiler.print_stats();
+			this->jobs.print_stats();
+			this->jobs.reset_stats();
+
+			this->frames_since_report = 0;
 		}
 
 	}
 
+	if (frame_limit > 0)
+	{
+		collect_profiler_frames();
+		this->profiler.print_stats();
+		this->jobs.print_stats();
+	}
+
 	return true;
 }
 
+bool VulkanApp::headless_loop()
+{
+	// Pending instance count and render mode are applied once, the timed frames all draw the same scene
+	if (this->requested_instance_count != this->instance_count && !resize_instance_buffers(this->requested_instance_count))
+		return false;
+
+	if (this->requested_render_mode != this->render_mode && !switch_render_mode())
+		return false;
+
+	const uint32_t measured_frames = this->measured_frames > 0 ? this->measured_frames : default_measured_frames;
+
+	for (uint32_t frame = 0; frame < this->warmup_frames; ++frame)
+	{
+		if (!draw_frame())
+			return false;
+	}
+
+	begin_measured_frames();
+
+	const auto t_start = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t frame = 0; frame < measured_frames; ++frame)
+	{
+		this->profiler.begin_cpu(this->profile_scopes.frame);
+
+		if (!draw_frame())
+			return false;
+
+		this->profiler.end_cpu();
+	}
+
+	// Throughput covers the GPU work too, not just the submits
+	vkDeviceWaitIdle(this->device);
+
+	const auto t_end = std::chrono::high_resolution_clock::now();
+	const auto total_ms = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+
+	std::cout << "Headless: " << measured_frames << " frames in " << total_ms << " ms, "
+		<< total_ms / measured_frames << " ms/frame, " << 1000.0 * measured_frames / total_ms << " FPS"
+		<< " (" << (this->render_mode == circle_render_mode::sdf ? "sdf" : "mesh")
+		<< ", " << get_instance_layout_name(this->instance_stream_layout) << " instances, " << this->instance_count << " circles"
+		<< ", " << this->frames_in_flight << " frames in flight)" << std::endl;
+
+	collect_profiler_frames();
+	this->profiler.print_stats();
+	this->jobs.print_stats();
+
+	return true;
+}
+
+void VulkanApp::collect_profiler_frames()
+{
+	// The last frames in flight were never collected by draw_frame
+	vkDeviceWaitIdle(this->device);
+
+	for (uint32_t frame = 0; frame < this->frames_in_flight; ++frame)
+		this->profiler.collect(frame);
+}
+
+void VulkanApp::begin_measured_frames()
+{
+	// Warm-up timings still in flight would land in the measured history otherwise
+	collect_profiler_frames();
+
+	this->profiler.reset_history();
+	this->jobs.reset_stats();
+	this->frames_since_report = 0;
+}
+
 bool VulkanApp::release()
 {
 	if (is_released)
@@ -1395,6 +2467,13 @@ bool VulkanApp::release()
 
 	vkDeviceWaitIdle(this->device);
 
+	if (this->simulation.is_running())
+	{
+		this->simulation.stop();
+		log("Simulation thread: " << this->simulation.get_tick_count() << " ticks, " << this->simulation.get_late_tick_count() << " late");
+	}
+	this->jobs.release();
+
 #if defined (_DEBUG)
 	auto DestroyDebugUtilsMessengerEXT = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
 
@@ -1406,36 +2485,65 @@ bool VulkanApp::release()
 
 	if (this->device)
 	{
-		vkDestroyBuffer(this->device, this->vertex_buffer, nullptr);
-		vkFreeMemory(this->device, this->vertex_buffer_memory, nullptr);
-
-		vkDestroyBuffer(this->device, this->index_buffer, nullptr);
-		vkFreeMemory(this->device, this->index_buffer_memory, nullptr);
+		release_retired_buffers(true);
+		this->deletions.flush();
+
+		this->vertex_buffer.destroy(this->device, this->allocator);
+		this->index_buffer.destroy(this->device, this->allocator);
+		this->colors_buffer.destroy(this->device, this->allocator);
+		this->positions_ring.destroy(this->device, this->allocator);
+		this->scales_buffer.destroy(this->device, this->allocator);
+		this->simulation_buffer.destroy(this->device, this->allocator);
+		this->frame_params_ring.destroy(this->device, this->allocator);
+		this->visible_ring.destroy(this->device, this->allocator);
+		this->cull_groups_buffer.destroy(this->device, this->allocator);
 
-		vkDestroyBuffer(this->device, this->colors_buffer, nullptr);
-		vkFreeMemory(this->device, this->colors_buffer_memory, nullptr);
+		cleanup_swap_chain();
 
-		vkDestroyBuffer(this->device, this->positions_buffer, nullptr);
-		vkFreeMemory(this->device, this->positions_buffer_memory, nullptr);
+		vkDestroyDescriptorPool(this->device, this->compute_descriptor_pool, nullptr);
+		vkDestroyDescriptorSetLayout(this->device, this->compute_descriptor_set_layout, nullptr);
 
-		vkDestroyBuffer(this->device, this->scales_buffer, nullptr);
-		vkFreeMemory(this->device, this->scales_buffer_memory, nullptr);
+		vkDestroyPipeline(this->device, this->compute_pipeline, nullptr);
+		for (auto pipeline : this->cull_pipelines)
+			vkDestroyPipeline(this->device, pipeline, nullptr);
+		vkDestroyPipelineLayout(this->device, this->compute_pipeline_layout, nullptr);
 
-		cleanup_swap_chain();
-
-		vkDestroyDescriptorSetLayout(this->device, this->ubo_descriptor_set_layout, nullptr);
+		vkDestroyDescriptorPool(this->device, this->instance_descriptor_pool, nullptr);
+		vkDestroyDescriptorSetLayout(this->device, this->instance_descriptor_set_layout, nullptr);
 
 		vkDestroyPipeline(this->device, this->graphics_pipeline, nullptr);
+		vkDestroyPipeline(this->device, this->sdf_pipeline, nullptr);
 		vkDestroyPipelineLayout(this->device, this->pipeline_layout, nullptr);
 
-		for (auto i = 0; i < this->num_frames; ++i)
+		for (auto& frame : this->frames)
 		{
-			vkDestroySemaphore(this->device, this->image_available_semaphore[i], nullptr);
-			vkDestroySemaphore(this->device, this->render_finished_semaphore[i], nullptr);
-			vkDestroyFence(this->device, this->draw_fences[i], nullptr);
+			vkDestroySemaphore(this->device, frame.image_available, nullptr);
+			vkDestroySemaphore(this->device, frame.render_finished, nullptr);
+			vkDestroySemaphore(this->device, frame.compute_finished, nullptr);
+			vkDestroyFence(this->device, frame.fence, nullptr);
 		}
+		this->graphics_timeline.release();
+		this->compute_timeline.release();
 
 		vkDestroyCommandPool(this->device, this->command_pool, nullptr);
+		vkDestroyCommandPool(this->device, this->compute_command_pool, nullptr);
+		for (auto& frame : this->frames)
+		{
+			for (auto pool : frame.secondary_pools)
+				vkDestroyCommandPool(this->device, pool, nullptr);
+		}
+
+		for (auto& frame : this->frames)
+			this->uploader.recycle_semaphores(frame.upload_wait_semaphores);
+		this->profiler.release();
+		this->uploader.release();
+
+		if (!this->pipeline_cache.save())
+			log("Couldn't save the pipeline cache");
+		this->pipeline_cache.release();
+
+		this->allocator.print_stats();
+		this->allocator.release();
 
 		// Destroy Device
 		vkDestroyDevice(this->device, nullptr);
@@ -1443,14 +2551,18 @@ bool VulkanApp::release()
 
 	if (this->instance)
 	{
-		vkDestroySurfaceKHR(this->instance, this->surface, nullptr);
+		if (this->surface != VK_NULL_HANDLE)
+			vkDestroySurfaceKHR(this->instance, this->surface, nullptr);
 
 		// Destroy Instance
 		vkDestroyInstance(this->instance, nullptr);
 	}
 
-	glfwDestroyWindow(this->window);
-	glfwTerminate();
+	if (!this->headless)
+	{
+		glfwDestroyWindow(this->window);
+		glfwTerminate();
+	}
 
 	is_released = true;
 	return true;
@@ -1461,111 +2573,434 @@ void VulkanApp::window_resize()
 	this->should_recreate_swapchain = true;
 }
 
+void VulkanApp::key_press(const int& key)
+{
+	switch (key)
+	{
+	case GLFW_KEY_EQUAL:
+	case GLFW_KEY_KP_ADD:
+		set_instance_count(this->requested_instance_count * 2);
+		break;
+	case GLFW_KEY_MINUS:
+	case GLFW_KEY_KP_SUBTRACT:
+		set_instance_count(this->requested_instance_count / 2);
+		break;
+	case GLFW_KEY_LEFT:
+	case GLFW_KEY_RIGHT:
+	case GLFW_KEY_UP:
+	case GLFW_KEY_DOWN:
+	{
+		// Pan by a tenth of the view
+		const glm::vec2 view = glm::vec2(static_cast<float>(this->swap_chain_extent.width), static_cast<float>(this->swap_chain_extent.height)) / this->camera_zoom;
+		const glm::vec2 direction(
+			key == GLFW_KEY_LEFT ? -1.0f : key == GLFW_KEY_RIGHT ? 1.0f : 0.0f,
+			key == GLFW_KEY_UP ? -1.0f : key == GLFW_KEY_DOWN ? 1.0f : 0.0f);
+		this->camera_position += direction * view * 0.1f;
+		break;
+	}
+	case GLFW_KEY_PAGE_UP:
+	case GLFW_KEY_PAGE_DOWN:
+	{
+		// Zoom around the center of the view
+		const glm::vec2 extent(static_cast<float>(this->swap_chain_extent.width), static_cast<float>(this->swap_chain_extent.height));
+		const glm::vec2 center = this->camera_position + extent * 0.5f / this->camera_zoom;
+		this->camera_zoom = glm::clamp(key == GLFW_KEY_PAGE_UP ? this->camera_zoom * 1.25f : this->camera_zoom / 1.25f, 0.05f, 64.0f);
+		this->camera_position = center - extent * 0.5f / this->camera_zoom;
+		break;
+	}
+	case GLFW_KEY_M:
+		set_render_mode(this->requested_render_mode == circle_render_mode::sdf ? circle_render_mode::mesh : circle_render_mode::sdf);
+		break;
+	case GLFW_KEY_HOME:
+		this->camera_position = glm::vec2(0.0f);
+		this->camera_zoom = 1.0f;
+		break;
+	default:
+		break;
+	}
+}
+
+void VulkanApp::set_instance_count(const size& count)
+{
+	this->requested_instance_count = std::min(std::max(count, static_cast<size>(1)), max_instance_count);
+}
+
+void VulkanApp::set_render_mode(const circle_render_mode& mode)
+{
+	this->requested_render_mode = mode;
+}
+
+void VulkanApp::set_instance_layout(const instance_layout& layout)
+{
+	this->instance_stream_layout = layout;
+}
+
+void VulkanApp::set_frames_in_flight(const uint32_t& count)
+{
+	this->frames_in_flight = std::min(std::max(count, 1u), max_frames_in_flight);
+}
+
+void VulkanApp::set_headless()
+{
+	this->headless = true;
+}
+
+void VulkanApp::set_frame_limit(const uint32_t& warmup_frames, const uint32_t& measured_frames)
+{
+	this->warmup_frames = warmup_frames;
+	this->measured_frames = measured_frames;
+}
+
+void VulkanApp::set_circle_segments(const uint32_t& segments)
+{
+	this->circle_segments = segments == 0 ? 0 : std::min(std::max(segments, min_circle_segments), max_circle_segments);
+}
+
+void VulkanApp::set_cpu_physics(const bool& enabled)
+{
+	this->cpu_physics = enabled;
+}
+
+void VulkanApp::set_simulation_thread(const bool& enabled)
+{
+	this->threaded_simulation = enabled;
+	if (enabled)
+		this->cpu_physics = true;
+}
+
+void VulkanApp::set_worker_threads(const uint32_t& count)
+{
+	this->worker_threads = count;
+}
+
+void VulkanApp::set_parallel_recording(const bool& enabled)
+{
+	this->parallel_recording = enabled;
+}
+
+void VulkanApp::set_timeline_semaphores(const bool& enabled)
+{
+	this->timeline_semaphores_enabled = enabled;
+}
+
+void VulkanApp::set_shader_directory(const std::string& directory)
+{
+	this->shaders.set_override_directory(directory);
+}
+
+void VulkanApp::set_circle_collisions(const bool& enabled)
+{
+	this->physics.collisions = enabled;
+	if (enabled)
+		this->cpu_physics = true;
+}
+
+std::vector<profiler::scope_stats> VulkanApp::get_profile_stats() const
+{
+	return this->profiler.get_stats();
+}
+
 bool VulkanApp::create_colors_buffer()
 {
-	const VkDeviceSize buffer_size = sizeof(glm::vec3) * instance_count;
+	return helper::create_buffer(
+		this->device,
+		this->allocator,
+		sizeof(glm::vec3) * this->instance_capacity,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		this->colors_buffer,
+		this->upload_queue_families);
+}
+
+bool VulkanApp::create_positions_buffer()
+{
+	// The pulled vertex shaders read the slice as well, shared with the graphics family instead of transferred every frame
+	std::vector<uint32_t> queue_families;
+	if (this->instance_stream_layout == instance_layout::pulled && this->family_indices.compute_family != this->family_indices.graphics_family)
+		queue_families = { this->family_indices.compute_family.value(), this->family_indices.graphics_family.value() };
+
+	return helper::create_ring_buffer(
+		this->device,
+		this->allocator,
+		sizeof(glm::vec2) * this->instance_capacity,
+		this->frames_in_flight,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		this->positions_ring,
+		this->cpu_physics ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		queue_families);
+}
+
+bool VulkanApp::create_scales_buffer()
+{
+	return helper::create_buffer(
+		this->device,
+		this->allocator,
+		sizeof(float) * this->instance_capacity,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		this->scales_buffer,
+		this->upload_queue_families);
+}
 
+bool VulkanApp::create_simulation_buffers()
+{
 	if (!helper::create_buffer(
 		this->device,
-		this->physical_device,
-		buffer_size,
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
-		this->colors_buffer,
-		this->colors_buffer_memory))
+		this->allocator,
+		sizeof(circle_state) * this->instance_capacity,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		this->simulation_buffer,
+		this->upload_queue_families))
 	{
 		return false;
 	}
 
-	void* data = nullptr;
-	vkMapMemory(this->device, this->colors_buffer_memory, 0, buffer_size, 0, &data);
-	memcpy(data, this->circles.colors.data(), buffer_size);
-	vkUnmapMemory(this->device, this->colors_buffer_memory);
-
-	return true;
+	return helper::create_ring_buffer(
+		this->device,
+		this->allocator,
+		sizeof(FrameParams),
+		this->frames_in_flight,
+		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		this->frame_params_ring);
 }
 
-bool VulkanApp::create_positions_buffer()
+bool VulkanApp::create_visible_buffers()
 {
-	const VkDeviceSize buffer_size = sizeof(glm::vec2) * instance_count;
-
-	if (!helper::create_buffer(
+	// Slice layout: draw commands | positions | colors | scales, every stream on a storage offset friendly boundary.
+	// The packed layout puts the interleaved instances in the positions range and the pulled one the instance ids,
+	// the other two shrink to a placeholder.
+	constexpr VkDeviceSize alignment = 256;
+	const auto align = [](const VkDeviceSize& value) { return (value + alignment - 1) & ~(alignment - 1); };
+
+	const bool separate = this->instance_stream_layout == instance_layout::separate;
+	const VkDeviceSize first_stride =
+		this->instance_stream_layout == instance_layout::packed ? sizeof(packed_instance) :
+		this->instance_stream_layout == instance_layout::pulled ? sizeof(uint32_t) : sizeof(glm::vec2);
+
+	this->visible_positions_offset = align(sizeof(VkDrawIndexedIndirectCommand) * max_circle_lods);
+	this->visible_colors_offset = this->visible_positions_offset + align(first_stride * this->instance_capacity);
+	this->visible_scales_offset = this->visible_colors_offset + (separate ? align(sizeof(glm::vec3) * this->instance_capacity) : alignment);
+
+	if (!helper::create_ring_buffer(
 		this->device,
-		this->physical_device,
-		buffer_size,
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
-		this->positions_buffer,
-		this->positions_buffer_memory))
+		this->allocator,
+		this->visible_scales_offset + (separate ? sizeof(float) * this->instance_capacity : alignment),
+		this->frames_in_flight,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		this->visible_ring,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
 	{
 		return false;
 	}
 
-	void* data = nullptr;
-	vkMapMemory(this->device, this->positions_buffer_memory, 0, buffer_size, 0, &data);
-	memcpy(data, this->circles.positions.data(), buffer_size);
-	vkUnmapMemory(this->device, this->positions_buffer_memory);
+	const VkDeviceSize group_count = (this->instance_capacity + 255) / 256;
 
-	return true;
+	return helper::create_buffer(
+		this->device,
+		this->allocator,
+		2 * max_circle_lods * sizeof(uint32_t) * group_count,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		this->cull_groups_buffer);
 }
 
-bool VulkanApp::create_scales_buffer()
+bool VulkanApp::upload_instance_data(const size& first, const size& count)
 {
-	const VkDeviceSize buffer_size = sizeof(float) * instance_count;
+	if (count == 0)
+		return true;
+
+	// Colors
+	memcpy(static_cast<glm::vec3*>(this->colors_buffer.get_mapped()) + first, this->circles.colors.data() + first, sizeof(glm::vec3) * count);
 
-	VkBuffer staging_buffer;
-	VkDeviceMemory staging_buffer_memory;
+	// Scales (Device Local), recorded into the current upload batch
+	if (!this->uploader.upload(this->scales_buffer.buffer, sizeof(float) * first, this->circles.scales.data() + first, sizeof(float) * count))
+		return false;
+
+	// Initial simulation state, the positions ring is filled by the simulation every frame
+	std::vector<circle_state> states(count);
+	for (size i = 0; i < count; ++i)
+	{
+		states[i].position = this->circles.positions[first + i];
+		states[i].velocity = this->circles.velocities[first + i];
+	}
+
+	return this->uploader.upload(this->simulation_buffer.buffer, sizeof(circle_state) * first, states.data(), sizeof(circle_state) * count);
+}
+
+bool VulkanApp::grow_instance_buffer(
+	buffer& instance_buffer,
+	const VkDeviceSize& element_size,
+	const VkBufferUsageFlags& usage,
+	const VkMemoryPropertyFlags& memory_properties,
+	const size& new_capacity)
+{
+	buffer new_buffer;
 
 	if (!helper::create_buffer(
 		this->device,
-		this->physical_device,
-		buffer_size,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		staging_buffer,
-		staging_buffer_memory))
+		this->allocator,
+		element_size * new_capacity,
+		usage,
+		memory_properties,
+		new_buffer,
+		this->upload_queue_families))
 	{
 		return false;
 	}
 
-	void* data = nullptr;
-	vkMapMemory(this->device, staging_buffer_memory, 0, buffer_size, 0, &data);
-	memcpy(data, this->circles.scales.data(), buffer_size);
-	vkUnmapMemory(this->device, staging_buffer_memory);
+	// Live range stays on the GPU, only the new tail gets uploaded from the CPU
+	if (this->instance_count > 0 && !this->uploader.copy(instance_buffer.buffer, new_buffer.buffer, element_size * this->instance_count))
+		return false;
 
-	if (!helper::create_buffer(
-		this->device,
-		this->physical_device,
-		buffer_size,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		this->scales_buffer,
-		this->scales_buffer_memory))
+	// The old buffer is the copy source, it goes away once resize_instance_buffers() has flushed the batch
+	this->retired_buffers.push_back({ instance_buffer, 0 });
+	instance_buffer = new_buffer;
+
+	return true;
+}
+
+bool VulkanApp::resize_instance_buffers(const size& count)
+{
+	// Compute command buffers and old instance buffers may still be in use by frames in flight
+	wait_frames_in_flight();
+
+	if (count > this->instance_capacity)
 	{
+		const size new_capacity = std::max(count, std::min(this->instance_capacity * 2, max_instance_count));
+
+		const VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+		if (!grow_instance_buffer(this->colors_buffer, sizeof(glm::vec3), usage,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, new_capacity))
+			return false;
+		if (!grow_instance_buffer(this->scales_buffer, sizeof(float), usage,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, new_capacity))
+			return false;
+		if (!grow_instance_buffer(this->simulation_buffer, sizeof(circle_state), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, new_capacity))
+			return false;
+
+		this->instance_capacity = new_capacity;
+
+		// Nothing to preserve, these are rewritten by the simulation and the cull passes every frame
+		this->positions_ring.destroy(this->device, this->allocator);
+		this->visible_ring.destroy(this->device, this->allocator);
+		this->cull_groups_buffer.destroy(this->device, this->allocator);
+		if (!create_positions_buffer() || !create_visible_buffers())
+			return false;
+
+		update_compute_descriptor_sets();
+		update_instance_descriptor_sets();
+	}
+
+	const size old_count = this->instance_count;
+
+	// The simulation thread owns the physics while it runs
+	const bool restart_simulation = this->simulation.is_running();
+	this->simulation.stop();
+
+	setup_circles(old_count, count);
+	this->instance_count = count;
+
+	if (restart_simulation)
+		this->simulation.start(&this->physics, &this->jobs);
+
+	if (count > old_count && !upload_instance_data(old_count, count - old_count))
 		return false;
+
+	// Next submit waits on the batch semaphore, no need to block here
+	const auto batch = this->uploader.flush();
+	for (auto& retired : this->retired_buffers)
+	{
+		if (retired.upload_batch == 0)
+			retired.upload_batch = batch;
 	}
 
-	helper::copy_buffer(this->device, this->command_pool, this->graphics_queue, staging_buffer, this->scales_buffer, buffer_size);
+	return record_compute_command_buffers();
+}
 
-	vkDestroyBuffer(this->device, staging_buffer, nullptr);
-	vkFreeMemory(this->device, staging_buffer_memory, nullptr);
+bool VulkanApp::switch_render_mode()
+{
+	// Frames in flight keep their own recordings, the next one is recorded with the new mode
+	this->render_mode = this->requested_render_mode;
+
+	// Timings restart so the next report only covers the new mode
+	this->profiler.reset_history();
+	this->frames_since_report = 0;
 
 	return true;
 }
 
-void VulkanApp::setup_circles()
+bool VulkanApp::recreate_pipelines()
+{
+	// Pipelines are referenced by the frames in flight and by the recorded compute command buffers
+	vkDeviceWaitIdle(this->device);
+
+	vkDestroyPipeline(this->device, this->graphics_pipeline, nullptr);
+	vkDestroyPipeline(this->device, this->sdf_pipeline, nullptr);
+	vkDestroyPipelineLayout(this->device, this->pipeline_layout, nullptr);
+
+	vkDestroyPipeline(this->device, this->compute_pipeline, nullptr);
+	for (auto& pipeline : this->cull_pipelines)
+		vkDestroyPipeline(this->device, pipeline, nullptr);
+	vkDestroyPipelineLayout(this->device, this->compute_pipeline_layout, nullptr);
+
+	log("Recreating pipelines");
+
+	if (!create_graphics_pipeline())
+		return false;
+
+	if (!create_compute_pipeline())
+		return false;
+
+	return record_compute_command_buffers();
+}
+
+void VulkanApp::release_retired_buffers(const bool& wait_all)
+{
+	auto it = this->retired_buffers.begin();
+	while (it != this->retired_buffers.end())
+	{
+		if (wait_all)
+			this->uploader.wait(it->upload_batch);
+
+		if (wait_all || (it->upload_batch != 0 && this->uploader.is_complete(it->upload_batch)))
+		{
+			it->buffer.destroy(this->device, this->allocator);
+			it = this->retired_buffers.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void VulkanApp::setup_circles(const size& first, const size& count)
 {
-	this->circles.resize(instance_count);
+	this->circles.resize(count);
 
-	const int max_size = glm::sqrt((screen_width * screen_height) / instance_count) * 0.5f;
-	const int min_size = max_size / 3;
+	const int max_size = std::min(std::max(static_cast<int>(glm::sqrt(static_cast<float>(screen_width * screen_height) / count) * 0.5f), 2), screen_height / 2 - 1);
+	const int min_size = std::max(max_size / 3, 1);
 
-	for (size_t i = 0; i < instance_count; ++i)
+	for (size_t i = first; i < count; ++i)
 	{
-		this->circles.scales[i] = min_size + (rand() % (max_size - min_size));
+		this->circles.scales[i] = static_cast<float>(min_size + (rand() % (max_size - min_size + 1)));
 		this->circles.positions[i] = glm::vec2(
 			this->circles.scales[i] + rand() % (screen_width - 2 * static_cast<int>(this->circles.scales[i])),
 			this->circles.scales[i] + rand() % (screen_height - 2 * static_cast<int>(this->circles.scales[i])));
 		this->circles.colors[i] = glm::vec3((rand() % 255) / 255.0f, (rand() % 255) / 255.0f, (rand() % 255) / 255.0f);
+
+		const float angle = glm::two_pi<float>() * (rand() % 360) / 360.0f;
+		const float speed = static_cast<float>(20 + rand() % 100); // pixels per second
+		this->circles.velocities[i] = glm::vec2(glm::cos(angle), glm::sin(angle)) * speed;
 	}
-}
\ No newline at end of file
+
+	if (this->cpu_physics)
+	{
+		this->physics.resize(count);
+		for (size_t i = first; i < count; ++i)
+			this->physics.set_circle(static_cast<uint32_t>(i), this->circles.positions[i], this->circles.velocities[i], this->circles.scales[i]);
+	}
+}
@@ -5,18 +5,51 @@
 
 struct circles_strcut
 {
-	std::vector<glm::vec2> positions;
+	std::vector<glm::vec2> positions; // initial state, simulated on the GPU afterwards
+	std::vector<glm::vec2> velocities;
 	std::vector<glm::vec3> colors;
 	std::vector<float> scales; // = radius
 
 	inline void resize(const size_t& size)
 	{
 		positions.resize(size);
+		velocities.resize(size);
 		colors.resize(size);
 		scales.resize(size);
 	}
 };
  
+// Everything one frame in flight owns, reused once its previous frame has finished (wait_for_frame)
+struct FrameContext
+{
+	VkCommandBuffer command_buffer;			// graphics, recorded every frame for the acquired image
+	VkCommandBuffer compute_command_buffer;	// simulate and cull, re-recorded when the instance count changes
+	// Parallel recording only: the draws of the render pass, one slice of the level of detail buckets each. Every one has
+	// a transient pool of its own, so the workers never share one, reset when the slice is recorded again.
+	std::vector<VkCommandPool> secondary_pools;
+	std::vector<VkCommandBuffer> secondary_command_buffers;
+	VkDescriptorSet compute_descriptor_set;
+	VkDescriptorSet instance_descriptor_set = VK_NULL_HANDLE;	// pulled layout only: visible ids and instance data
+	uint64_t submitted_frame = 0;	// number of the last submit of this context, see VulkanApp::wait_for_frame()
+
+	// Binary, the swap chain can't wait on or signal timeline semaphores
+	VkSemaphore image_available;
+	VkSemaphore render_finished;
+	// Without timeline semaphores only
+	VkSemaphore compute_finished = VK_NULL_HANDLE;
+	VkFence fence = VK_NULL_HANDLE;
+
+	// Upload semaphores waited on by this frame's submit, handed back once the fence signals
+	std::vector<VkSemaphore> upload_wait_semaphores;
+};
+
+// How circles are rasterized, both read the same culled instance streams
+enum class circle_render_mode
+{
+	mesh,	// tessellated circle model
+	sdf,	// one quad per instance, coverage from the analytic distance in the fragment shader
+};
+
 struct VulkanApp
 {
 public:
@@ -28,6 +61,56 @@ public:
 
 	void window_resize();
 
+	void key_press(const int& key);
+
+	// Takes effect at the start of the next frame, clamped to [1, max_instance_count]
+	void set_instance_count(const size& count);
+
+	// Takes effect at the start of the next frame
+	void set_render_mode(const circle_render_mode& mode);
+
+	// Only before run(), pipelines and the visible streams are built for it
+	void set_instance_layout(const renderer::instance_layout& layout);
+
+	// Only before run(), clamped to [1, max_frames_in_flight]. More frames trade latency for CPU/GPU overlap.
+	void set_frames_in_flight(const uint32_t& count);
+
+	// Only before run(). Renders into offscreen images without a window, surface or present queue,
+	// then prints the throughput.
+	void set_headless();
+
+	// Only before run(). Stops after warmup_frames + measured_frames, the profiler history only covers the measured ones.
+	// measured_frames == 0 runs until the window is closed, or default_measured_frames frames when headless.
+	void set_frame_limit(const uint32_t& warmup_frames, const uint32_t& measured_frames);
+
+	// Only before run(). One fixed level of detail with this many segments, clamped to [min_circle_segments, max_circle_segments].
+	// 0 keeps the default level of detail chain.
+	void set_circle_segments(const uint32_t& segments);
+
+	// Only before run(). Circles are simulated on the CPU (circle_physics) and their positions written into a host visible
+	// ring every frame, instead of by the simulate compute pass.
+	void set_cpu_physics(const bool& enabled);
+	// Only before run(). Circles bounce off each other as well, implies set_cpu_physics(true).
+	void set_circle_collisions(const bool& enabled);
+	// Only before run(). The CPU physics tick on a thread of their own at a fixed rate and the frames blend the
+	// latest two ticks (simulation_thread), implies set_cpu_physics(true).
+	void set_simulation_thread(const bool& enabled);
+	// Only before run(). Threads of the job system (CPU physics, parallel recording) including the main thread, 0 is one
+	// per hardware thread.
+	void set_worker_threads(const uint32_t& count);
+	// Only before run(). The draws are recorded into secondary command buffers by the job system every frame, the primary
+	// one only begins the render pass and executes them.
+	void set_parallel_recording(const bool& enabled);
+	// Only before run(). Frames and uploads are synchronized with VK_KHR_timeline_semaphore when the device supports it,
+	// disabling it falls back to fences and binary semaphores.
+	void set_timeline_semaphores(const bool& enabled);
+	// Only before run(). .spv files in the directory replace the embedded shaders of the same name and are reloaded
+	// when they change while running (shader_library).
+	void set_shader_directory(const std::string& directory);
+
+	// Timings of the measured frames, valid after run()
+	std::vector<renderer::profiler::scope_stats> get_profile_stats() const;
+
 private:
 
 	bool setup_window();
@@ -38,70 +121,163 @@ private:
 	bool pick_physical_device();
 
 	bool check_device_extensions_support();
+	bool supports_timeline_semaphores();
 	bool create_logical_device();
 	bool create_surface();
+	bool create_profiler();
+	bool create_pipeline_cache();
 	bool create_swap_chain();
+	bool create_offscreen_images();
 	bool create_image_views();
 	bool create_renderpass();
-	bool create_descriptor_set_layout();
+	bool create_instance_descriptor_set_layout();
 	bool create_graphics_pipeline();
+	bool create_compute_descriptor_set_layout();
+	bool create_compute_pipeline();
 	bool create_vertex_buffer();
 	bool create_index_buffer();
 	bool create_instance_buffers();
-	bool create_uniform_buffers();
-	bool create_descriptor_pool();
-	bool create_descriptor_sets();
 	bool create_frame_buffers();
 	bool create_command_pool();
 	bool create_command_buffers();
+	bool create_secondary_command_buffers();
 	bool create_sync_objects();
+	bool create_compute_descriptor_pool();
+	bool create_compute_descriptor_sets();
+	bool create_instance_descriptor_sets();
+	bool create_compute_command_buffers();
+	void wait_frames_in_flight();
+	// Frame numbers count the graphics submits from 1, 0 is complete from the start
+	bool wait_for_frame(const uint64_t& frame_number);
 	
 	bool create_colors_buffer();
 	bool create_positions_buffer();
 	bool create_scales_buffer();
+	bool create_simulation_buffers();
+	bool create_visible_buffers();
+
+	bool upload_instance_data(const size& first, const size& count);
+	bool grow_instance_buffer(
+		renderer::buffer& instance_buffer,
+		const VkDeviceSize& element_size,
+		const VkBufferUsageFlags& usage,
+		const VkMemoryPropertyFlags& memory_properties,
+		const size& new_capacity);
+	bool resize_instance_buffers(const size& count);
+	bool switch_render_mode();
+	bool recreate_pipelines();
+	void release_retired_buffers(const bool& wait_all);
+	bool record_command_buffer(FrameContext& frame, const uint32_t& frame_index, const uint32_t& image_index);
+	// Binds everything the circle pipelines read and issues the draws [first_draw, first_draw + draw_count) of the frame.
+	// Only reads the app, safe to call from several workers on different command buffers.
+	void record_draws(VkCommandBuffer command_buffer, const FrameContext& frame, const uint32_t& frame_index, const uint32_t& first_draw, const uint32_t& draw_count) const;
+	// Parallel recording: one job per secondary command buffer, executed by the primary one inside the render pass
+	bool record_secondary_command_buffers(FrameContext& frame, const uint32_t& frame_index, const uint32_t& image_index, const uint32_t& draw_count);
+	void update_compute_descriptor_sets();
+	void update_instance_descriptor_sets();
+	bool record_compute_command_buffers();
 
 	bool cleanup_swap_chain();
 	bool recreate_swap_chain();
 	bool set_viewport_scissor();
 
-	void update(const uint32_t& current_image);
+	void update();
 
 	bool draw_frame();
 
 	bool main_loop();
+	bool headless_loop();
+	// Waits for the GPU and reads back the timestamps of every frame in flight
+	void collect_profiler_frames();
+	void begin_measured_frames();
 	
+	// Every circle level of detail packed into one vertex and index buffer
 	renderer::model circle_model;
+	std::vector<renderer::model_lod> circle_lods;
+	renderer::model_lod quad_lod;
+	// Buckets start at a non-zero firstInstance, without the feature everything is drawn with one level
+	bool lod_buckets_enabled = false;
+	uint32_t circle_segments = 0; // 0: default level of detail chain
 
-	void setup_circles();
+	void setup_circles(const size& first, const size& count);
 	circles_strcut circles;
 
-	std::vector<VkBuffer> ubo_buffers;
-	std::vector<VkDeviceMemory> ubo_buffers_memory;
+	bool cpu_physics = false;
+	renderer::circle_physics physics;
+	renderer::job_system jobs;
+	uint32_t worker_threads = 0;
+	bool parallel_recording = false;
+	uint32_t record_job = renderer::job_system::invalid_type;
+	bool threaded_simulation = false;
+	renderer::simulation_thread simulation;
+
+	size instance_count = 0;
+	size instance_capacity = 0;
+	size requested_instance_count = default_instance_count;
+
+	circle_render_mode render_mode = circle_render_mode::mesh;
+	circle_render_mode requested_render_mode = circle_render_mode::mesh;
+	renderer::instance_layout instance_stream_layout = renderer::instance_layout::separate;
+
+	// Top left corner of the view in world space (pixels at zoom 1)
+	glm::vec2 camera_position = glm::vec2(0.0f);
+	float camera_zoom = 1.0f;
+
+	renderer::memory_allocator allocator;
+	renderer::upload_manager uploader;
+	// Families sharing buffers that the upload queue writes, one entry when everything runs on the graphics queue
+	std::vector<uint32_t> upload_queue_families;
+
+	// Replaced buffers stay alive until the upload batch reading from them has finished
+	struct retired_buffer
+	{
+		renderer::buffer buffer;
+		uint64_t upload_batch;
+	};
+	std::vector<retired_buffer> retired_buffers;
+
+	// Written by update(), pushed when the frame is recorded
+	renderer::camera_constants camera;
+
+	renderer::buffer vertex_buffer;
+	renderer::buffer index_buffer; // circle model indices followed by the SDF quad indices
+	renderer::buffer colors_buffer;
+	renderer::buffer scales_buffer;
+	
+	// Written by the simulation every frame, one slice per frame in flight. Only read by the cull passes.
+	renderer::ring_buffer positions_ring;
 
-	VkBuffer vertex_buffer;
-	VkDeviceMemory vertex_buffer_memory;
+	// Positions and velocities, only the compute queue (and uploads) touch it
+	renderer::buffer simulation_buffer;
+	renderer::ring_buffer frame_params_ring;
 
-	VkBuffer index_buffer;
-	VkDeviceMemory index_buffer_memory;
+	// Per frame in flight: one indirect draw command per level of detail followed by the compacted position, color and scale streams
+	// of the circles that survived culling. Written by the compute family, released to graphics for drawing.
+	renderer::ring_buffer visible_ring;
+	VkDeviceSize visible_positions_offset = 0; // packed_instance stream with the packed layout, instance ids with the pulled one
+	VkDeviceSize visible_colors_offset = 0;
+	VkDeviceSize visible_scales_offset = 0;
+	// Visible count and first slot per level of detail and cull workgroup
+	renderer::buffer cull_groups_buffer;
 
-	VkBuffer colors_buffer;
-	VkDeviceMemory colors_buffer_memory;
+	VkDescriptorPool compute_descriptor_pool;
+	VkDescriptorSetLayout compute_descriptor_set_layout;
 
-	VkBuffer scales_buffer;
-	VkDeviceMemory scales_buffer_memory;
-	
-	VkBuffer positions_buffer;
-	VkDeviceMemory positions_buffer_memory;
+	VkPipelineLayout compute_pipeline_layout;
+	VkPipeline compute_pipeline;
+	VkPipeline cull_pipelines[3]; // count, scan, scatter
+
+	VkCommandPool compute_command_pool;
 
-	VkDescriptorPool ubo_descriptor_pool;
-	std::vector<VkDescriptorSet> ubo_descriptor_sets;
-	VkDescriptorSetLayout ubo_descriptor_set_layout;
+	// Storage buffers of the pulled vertex shaders, not created for the other layouts
+	VkDescriptorPool instance_descriptor_pool = VK_NULL_HANDLE;
+	VkDescriptorSetLayout instance_descriptor_set_layout = VK_NULL_HANDLE;
 
 	VkPipelineLayout pipeline_layout;
 	VkPipeline graphics_pipeline;
+	VkPipeline sdf_pipeline;
 	
 	VkCommandPool command_pool;
-	std::vector<VkCommandBuffer> command_buffers;
 
 	//	Vulkan
 	VkInstance instance = VK_NULL_HANDLE;
@@ -114,30 +290,69 @@ private:
 
 	VkQueue graphics_queue;
 	VkQueue present_queue;
+	VkQueue transfer_queue;
+	VkQueue compute_queue;
 
-	bool should_recreate_swapchain;
+	bool should_recreate_swapchain = false;
 
-	VkSwapchainKHR swap_chain;
+	VkSwapchainKHR swap_chain = VK_NULL_HANDLE;
 	std::vector<VkImage> swap_chain_images;
 	std::vector<VkImageView> swap_chain_image_views;
 	std::vector<VkFramebuffer> swap_chain_frame_buffers;
 	VkFormat swap_chain_image_format;
 	VkExtent2D swap_chain_extent;
 
+	// Headless: swap_chain_images point into these, acquired round robin instead of from a swap chain
+	bool headless = false;
+	std::vector<renderer::image> offscreen_images;
+	uint32_t next_offscreen_image = 0;
+
 	VkViewport viewport;
 	VkRect2D scissor;
 
-	std::vector<VkSemaphore> image_available_semaphore;
-	std::vector<VkSemaphore> render_finished_semaphore;
-	std::vector<VkFence> draw_fences;
-
+	// Fixed for the lifetime of the device, independent of the swap chain image count
+	uint32_t frames_in_flight = default_frames_in_flight;
+	std::vector<FrameContext> frames;
+	// Number of the frame last rendering to each swap chain image, 0 when none
+	std::vector<uint64_t> images_in_flight;
+
+	// Frames submitted so far, the numbers the deletion queue waits for
+	uint64_t submitted_frames = 0;
+
+	// Frame N signals N on the compute timeline when its compute passes are done and on the graphics one when it has
+	// been rendered. They replace the fences and compute semaphores of the frame contexts.
+	bool timeline_semaphores = false;
+	bool timeline_semaphores_enabled = true; // set_timeline_semaphores()
+	// VK_KHR_get_physical_device_properties2 was enabled on the instance, needed to query the timeline feature
+	bool physical_device_properties2 = false;
+	renderer::timeline_semaphore graphics_timeline;
+	renderer::timeline_semaphore compute_timeline;
+	renderer::deletion_queue deletions;
+
+	renderer::pipeline_cache pipeline_cache;
+	renderer::shader_library shaders;
+
+	renderer::profiler profiler;
+	// Scope ids handed out by the profiler
+	struct
+	{
+		uint32_t frame, wait, acquire, update, physics, record, submit, present;	// CPU
+		uint32_t simulate, cull, render_pass, gpu_frame;						// GPU
+	} profile_scopes;
+	// Compute family writes timestamps, it resets each frame's queries since it executes first
+	bool compute_timestamps = false;
+	uint32_t frames_since_report = 0;
+
+	// 0 measured frames: no limit
+	uint32_t warmup_frames = 0;
+	uint32_t measured_frames = 0;
+
+	// Window title
 	std::chrono::time_point<std::chrono::high_resolution_clock> last_timestamp;
 	size_t frame_counter;
-	float frame_timer = 1.0f;
 	uint32_t last_fps = 0;
 
-	size_t num_frames;
-	size_t current_frame = 0;
+	uint32_t current_frame = 0;
 
 	bool validation_layers_enabled;
 
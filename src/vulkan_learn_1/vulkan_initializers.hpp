@@ -46,4 +46,38 @@ namespace initializers
 		write_descriptors_set.descriptorCount = descriptorCount;
 		return write_descriptors_set;
 	}
+
+	inline VkDescriptorSetLayoutBinding descriptor_set_layout_binding(
+		VkDescriptorType type,
+		VkShaderStageFlags stageFlags,
+		uint32_t binding,
+		uint32_t descriptorCount = 1)
+	{
+		VkDescriptorSetLayoutBinding set_layout_binding{};
+		set_layout_binding.descriptorType = type;
+		set_layout_binding.stageFlags = stageFlags;
+		set_layout_binding.binding = binding;
+		set_layout_binding.descriptorCount = descriptorCount;
+		return set_layout_binding;
+	}
+
+	inline VkMemoryBarrier memory_barrier(
+		VkAccessFlags srcAccessMask,
+		VkAccessFlags dstAccessMask)
+	{
+		VkMemoryBarrier memory_barrier{};
+		memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memory_barrier.srcAccessMask = srcAccessMask;
+		memory_barrier.dstAccessMask = dstAccessMask;
+		return memory_barrier;
+	}
+
+	inline VkBufferMemoryBarrier buffer_memory_barrier()
+	{
+		VkBufferMemoryBarrier buffer_memory_barrier{};
+		buffer_memory_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		buffer_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		buffer_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		return buffer_memory_barrier;
+	}
 }
\ No newline at end of file
@@ -0,0 +1,251 @@
+#include "vulkan_learn_1/vulkan_app.h"
+#include "physics_bench.h"
+
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Sweeps instance count (powers of two up to max_instance_count), circle segments, render mode and instance layout, one
+// VulkanApp per configuration, and writes the CPU frame time and GPU frame time (first to last timestamp of the frame,
+// across the compute and graphics queues) statistics of the measured frames as CSV.
+//
+//	--modes mesh,sdf			render modes to run
+//	--layouts packed,separate,pulled	instance layouts to run (separate by default)
+//	--segments 0,8,32,128		mesh tessellations, 0 is the default level of detail chain (sdf ignores it)
+//	--min-instances N			first instance count, rounded down to a power of two
+//	--max-instances N
+//	--warmup N					frames before measuring
+//	--frames N					measured frames per configuration
+//	--windowed					present to a window instead of rendering headless
+//	--out file.csv
+//	--physics					CPU collision benchmark instead (physics_bench.h), --min/max-instances, --warmup,
+//								--frames and --out apply to it as circles and steps
+//	--threads 1,2,4				job system thread counts for --physics, 0 is one per hardware thread
+
+struct bench_config
+{
+	circle_render_mode mode;
+	renderer::instance_layout layout;
+	uint32_t segments;
+	size instances;
+};
+
+static bool parse_list(const char* option, const char* arg, std::vector<uint32_t>& values)
+{
+	values.clear();
+	std::stringstream stream(arg);
+	std::string item;
+
+	while (std::getline(stream, item, ','))
+	{
+		uint32_t value = 0;
+		if (item.empty())
+			continue;
+		if (!arguments::parse_uint(option, item, value))
+			return false;
+
+		values.push_back(value);
+	}
+
+	return true;
+}
+
+static const renderer::profiler::scope_stats* find_stats(const std::vector<renderer::profiler::scope_stats>& stats, const char* name)
+{
+	for (const auto& entry : stats)
+	{
+		if (entry.name == name)
+			return &entry;
+	}
+
+	return nullptr;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<circle_render_mode> modes = { circle_render_mode::mesh, circle_render_mode::sdf };
+	std::vector<renderer::instance_layout> layouts = { renderer::instance_layout::separate };
+	std::vector<uint32_t> segments = { 0 };
+	size min_instances = 1;
+	size max_instances = max_instance_count;
+	uint32_t warmup_frames = 100;
+	uint32_t measured_frames = 500;
+	bool windowed = false;
+	std::string out_file = "benchmark.csv";
+	bool physics = false;
+	physics_bench_options physics_options;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		// Consumes the option's argument
+		uint32_t value = 0;
+		const auto parse_value = [&]() { ++i; return arguments::parse_uint(argv[i - 1], argv[i], value); };
+
+		if (strcmp(argv[i], "--modes") == 0 && i + 1 < argc)
+		{
+			const std::string list = argv[++i];
+			modes.clear();
+			if (list.find("mesh") != std::string::npos)
+				modes.push_back(circle_render_mode::mesh);
+			if (list.find("sdf") != std::string::npos)
+				modes.push_back(circle_render_mode::sdf);
+		}
+		else if (strcmp(argv[i], "--layouts") == 0 && i + 1 < argc)
+		{
+			const std::string list = argv[++i];
+			layouts.clear();
+			if (list.find("packed") != std::string::npos)
+				layouts.push_back(renderer::instance_layout::packed);
+			if (list.find("separate") != std::string::npos)
+				layouts.push_back(renderer::instance_layout::separate);
+			if (list.find("pulled") != std::string::npos)
+				layouts.push_back(renderer::instance_layout::pulled);
+		}
+		else if (strcmp(argv[i], "--segments") == 0 && i + 1 < argc)
+		{
+			if (!parse_list(argv[i], argv[i + 1], segments))
+				return EXIT_FAILURE;
+			++i;
+		}
+		else if (strcmp(argv[i], "--min-instances") == 0 && i + 1 < argc)
+		{
+			if (!parse_value())
+				return EXIT_FAILURE;
+			min_instances = physics_options.min_circles = value;
+		}
+		else if (strcmp(argv[i], "--max-instances") == 0 && i + 1 < argc)
+		{
+			if (!parse_value())
+				return EXIT_FAILURE;
+			max_instances = physics_options.max_circles = value;
+		}
+		else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+		{
+			if (!parse_value())
+				return EXIT_FAILURE;
+			warmup_frames = physics_options.warmup_steps = value;
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			if (!parse_value())
+				return EXIT_FAILURE;
+			measured_frames = physics_options.measured_steps = value;
+		}
+		else if (strcmp(argv[i], "--windowed") == 0)
+			windowed = true;
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+			out_file = physics_options.out_file = argv[++i];
+		else if (strcmp(argv[i], "--physics") == 0)
+			physics = true;
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			if (!parse_list(argv[i], argv[i + 1], physics_options.thread_counts))
+				return EXIT_FAILURE;
+			++i;
+		}
+	}
+
+	if (physics)
+		return run_physics_bench(physics_options) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	max_instances = std::min(std::max(max_instances, static_cast<size>(1)), max_instance_count);
+	min_instances = std::min(std::max(min_instances, static_cast<size>(1)), max_instances);
+	measured_frames = std::max(measured_frames, 1u);
+
+	if (modes.empty() || layouts.empty() || segments.empty())
+	{
+		log("Nothing to run, check --modes, --layouts and --segments");
+		return EXIT_FAILURE;
+	}
+
+	// Powers of two, and the upper bound itself when it isn't one
+	std::vector<size> instance_counts;
+	size first = 1;
+	while (first * 2 <= min_instances)
+		first *= 2;
+	for (uint64_t count = first; count <= max_instances; count *= 2)
+		instance_counts.push_back(static_cast<size>(count));
+	if (instance_counts.back() != max_instances)
+		instance_counts.push_back(max_instances);
+
+	std::vector<bench_config> configs;
+	for (const auto& mode : modes)
+	{
+		// The quad of the sdf mode has no tessellation to sweep
+		const std::vector<uint32_t> mode_segments = mode == circle_render_mode::sdf ? std::vector<uint32_t>{ 0 } : segments;
+
+		for (const auto& layout : layouts)
+		{
+			for (const auto& segment_count : mode_segments)
+			{
+				for (const auto& instances : instance_counts)
+					configs.push_back({ mode, layout, segment_count, instances });
+			}
+		}
+	}
+
+	std::ofstream csv(out_file);
+	if (!csv)
+	{
+		log("Couldn't open " << out_file);
+		return EXIT_FAILURE;
+	}
+
+	csv << "mode,layout,segments,instances,headless,warmup_frames,measured_frames,"
+		<< "frame_mean_ms,frame_median_ms,frame_p99_ms,gpu_mean_ms,gpu_median_ms,gpu_p99_ms" << std::endl;
+
+	for (size_t c = 0; c < configs.size(); ++c)
+	{
+		const auto& config = configs[c];
+		const char* mode_name = config.mode == circle_render_mode::sdf ? "sdf" : "mesh";
+
+		const char* layout_name = renderer::get_instance_layout_name(config.layout);
+
+		log("[" << c + 1 << "/" << configs.size() << "] " << mode_name << ", " << layout_name << " instances, " << config.segments << " segments, " << config.instances << " circles");
+
+		// A fresh device per configuration, nothing carries over from the previous run
+		auto app = std::make_unique<VulkanApp>();
+		app->initialize();
+		app->set_instance_count(config.instances);
+		app->set_render_mode(config.mode);
+		app->set_instance_layout(config.layout);
+		app->set_circle_segments(config.segments);
+		app->set_frame_limit(warmup_frames, measured_frames);
+		if (!windowed)
+			app->set_headless();
+
+		if (!app->run())
+		{
+			log("Run failed, stopping the sweep");
+			return EXIT_FAILURE;
+		}
+
+		const auto stats = app->get_profile_stats();
+		const auto frame = find_stats(stats, "frame");
+		const auto gpu = find_stats(stats, "gpu frame");
+
+		csv << mode_name << "," << layout_name << "," << config.segments << "," << config.instances << "," << (windowed ? 0 : 1) << ","
+			<< warmup_frames << "," << measured_frames << ",";
+
+		if (frame != nullptr && frame->samples > 0)
+			csv << frame->mean_ms << "," << frame->p50_ms << "," << frame->p99_ms << ",";
+		else
+			csv << ",,,";
+
+		// Empty without timestamp support
+		if (gpu != nullptr && gpu->samples > 0)
+			csv << gpu->mean_ms << "," << gpu->p50_ms << "," << gpu->p99_ms;
+		else
+			csv << ",,";
+
+		// Flushed per row, a crash late in the sweep keeps the earlier results
+		csv << std::endl;
+	}
+
+	log("Results written to " << out_file);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+#include "physics_bench.h"
+
+#include "vulkan_learn_1/physics.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+	// Suffixes of the job types circle_physics adds, one mean and speedup column pair each
+	const char* const job_types[] = { "integrate", "sort", "collide", "write" };
+
+	enum class distribution
+	{
+		uniform,
+		clustered,
+	};
+
+	struct sample_stats
+	{
+		double mean = 0.0;
+		double median = 0.0;
+		double p99 = 0.0;
+	};
+
+	sample_stats get_stats(std::vector<double> samples)
+	{
+		sample_stats stats;
+		if (samples.empty())
+			return stats;
+
+		std::sort(samples.begin(), samples.end());
+
+		for (const auto& s : samples)
+			stats.mean += s;
+		stats.mean /= samples.size();
+
+		// Nearest rank, same as the profiler
+		const auto percentile = [&samples](const double& p) { return samples[static_cast<size_t>(p * (samples.size() - 1) + 0.5)]; };
+		stats.median = percentile(0.50);
+		stats.p99 = percentile(0.99);
+
+		return stats;
+	}
+
+	// The world grows with the count so every circle gets the same area on average (about a fifth of it covered),
+	// the clustered distribution piles them into a few spots instead
+	void setup_world(renderer::circle_physics& physics, const uint32_t& count, const distribution& kind)
+	{
+		constexpr float area_per_circle = 64.0f;
+		const float width = std::sqrt(count * area_per_circle * 16.0f / 9.0f);
+		const float height = width * 9.0f / 16.0f;
+
+		// Fixed seed, every run sees the same scene
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		std::vector<glm::vec2> centers(32);
+		for (auto& c : centers)
+			c = glm::vec2(unit(rng) * width, unit(rng) * height);
+		std::normal_distribution<float> spread(0.0f, width / 64.0f);
+
+		physics = renderer::circle_physics();
+		physics.extent = glm::vec2(width, height);
+		physics.collisions = true;
+		physics.resize(count);
+
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const float r = 1.0f + 2.0f * unit(rng);
+
+			glm::vec2 position;
+			if (kind == distribution::uniform)
+				position = glm::vec2(unit(rng) * width, unit(rng) * height);
+			else
+				position = centers[i % centers.size()] + glm::vec2(spread(rng), spread(rng));
+			position = glm::clamp(position, glm::vec2(r), physics.extent - glm::vec2(r));
+
+			const float angle = glm::two_pi<float>() * unit(rng);
+			const float speed = 20.0f + 100.0f * unit(rng);
+
+			physics.set_circle(i, position, glm::vec2(glm::cos(angle), glm::sin(angle)) * speed, r);
+		}
+	}
+}
+
+bool run_physics_bench(const physics_bench_options& options)
+{
+	std::ofstream csv(options.out_file);
+	if (!csv)
+	{
+		std::cout << "Couldn't open " << options.out_file << std::endl;
+		return false;
+	}
+
+	csv << "distribution,circles,instruction_set,threads,warmup_steps,measured_steps,"
+		<< "step_mean_ms,step_median_ms,step_p99_ms,broadphase_mean_ms,narrowphase_mean_ms,candidates_mean,contacts_mean";
+	for (const auto& type : job_types)
+		csv << "," << type << "_mean_ms," << type << "_speedup";
+	csv << std::endl;
+
+	for (const auto& requested_threads : options.thread_counts)
+	{
+		// A fresh pool per thread count, the job types and their stats start over with it
+		renderer::job_system jobs;
+		jobs.initialize(requested_threads);
+
+		renderer::circle_physics physics;
+
+		for (const auto kind : { distribution::uniform, distribution::clustered })
+		{
+			const char* kind_name = kind == distribution::uniform ? "uniform" : "clustered";
+
+			for (uint64_t count = std::max(options.min_circles, 1u); count <= options.max_circles; count *= 4)
+			{
+				std::cout << "Physics: " << kind_name << ", " << count << " circles, " << jobs.get_thread_count() << " threads" << std::endl;
+
+				setup_world(physics, static_cast<uint32_t>(count), kind);
+				physics.set_job_system(&jobs);
+
+				// Stands in for the instance upload of the app
+				std::vector<glm::vec2> positions(count);
+
+				for (uint32_t s = 0; s < options.warmup_steps; ++s)
+				{
+					physics.step(physics.step_dt);
+					physics.write_positions(positions.data(), 0, positions.size());
+				}
+
+				jobs.reset_stats();
+
+				std::vector<double> step_ms, broadphase_ms, narrowphase_ms, candidates, contacts;
+
+				for (uint32_t s = 0; s < options.measured_steps; ++s)
+				{
+					const auto t_start = std::chrono::high_resolution_clock::now();
+					physics.step(physics.step_dt);
+					const auto t_end = std::chrono::high_resolution_clock::now();
+
+					physics.write_positions(positions.data(), 0, positions.size());
+
+					step_ms.push_back(std::chrono::duration<double, std::milli>(t_end - t_start).count());
+					broadphase_ms.push_back(physics.last_collisions.broadphase_ms);
+					narrowphase_ms.push_back(physics.last_collisions.narrowphase_ms);
+					candidates.push_back(physics.last_collisions.candidates);
+					contacts.push_back(physics.last_collisions.contacts);
+				}
+
+				const auto step = get_stats(step_ms);
+				const auto job_stats = jobs.get_stats();
+
+				csv << kind_name << "," << count << "," << renderer::circle_physics::get_instruction_set() << "," << jobs.get_thread_count() << ","
+					<< options.warmup_steps << "," << options.measured_steps << ","
+					<< step.mean << "," << step.median << "," << step.p99 << ","
+					<< get_stats(broadphase_ms).mean << "," << get_stats(narrowphase_ms).mean << ","
+					<< get_stats(candidates).mean << "," << get_stats(contacts).mean;
+
+				for (const auto& type : job_types)
+				{
+					const renderer::job_system::job_stats* entry = nullptr;
+					for (const auto& candidate : job_stats)
+					{
+						if (candidate.name == std::string("physics ") + type)
+							entry = &candidate;
+					}
+
+					if (entry != nullptr)
+						csv << "," << entry->wall_ms / options.measured_steps << "," << entry->get_speedup();
+					else
+						csv << ",,";
+				}
+
+				csv << std::endl;
+			}
+		}
+	}
+
+	std::cout << "Results written to " << options.out_file << std::endl;
+
+	return true;
+}
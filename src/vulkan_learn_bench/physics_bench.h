@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// CPU only, no Vulkan device: steps circle_physics with collisions over uniform and clustered distributions
+// (powers of four from min_circles to max_circles) for every thread count and writes per step timings as CSV,
+// including wall time and speedup of every physics job type.
+struct physics_bench_options
+{
+	uint32_t min_circles = 1 << 14;
+	uint32_t max_circles = 1 << 20;
+	uint32_t warmup_steps = 20;
+	uint32_t measured_steps = 100;
+	std::vector<uint32_t> thread_counts = { 1, 0 }; // job system threads, 0 is one per hardware thread
+	std::string out_file = "physics_benchmark.csv";
+};
+
+bool run_physics_bench(const physics_bench_options& options);